@@ -0,0 +1,451 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Arbitration of the debug muxes between processes
+ *
+ * The debug muxes and the counter behind them exist once per SoC, so two
+ * processes measuring at the same time corrupt each other's selection and
+ * counts. Processes using /dev/mem therefore take turns, through a lock file
+ * shared by all debugcc instances and usable by other tools:
+ *
+ *  - Mutual exclusion is an flock() on the file, released by the kernel
+ *    should the holder die.
+ *  - Fairness comes from a ticket queue in the file: each request draws a
+ *    ticket and waits for its turn before taking the lock, so a client
+ *    sweeping all clocks can't starve one polling a single clock. Tickets of
+ *    waiters which died or gave up are skipped.
+ *  - Waiting is bounded; a measurement which can't get its turn in time is
+ *    reported as a fault, -EBUSY.
+ *
+ * The file is only used if owned by the effective user, who alone may write
+ * it, so other users can neither stall the queue nor plant results.
+ *
+ * The file also holds the latest result of each clock. A client whose turn
+ * comes after another client measured the same clock while it was waiting
+ * takes that result instead of measuring again, and can be allowed results
+ * up to a given age, so monitoring jobs polling the same clocks share the
+ * measurement time. Results are keyed by the platform and the path the clock
+ * is measured through, so differing clock tables don't mix, and are only
+ * taken if measured with at least the resolution the client would get.
+ */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <debugcc.h>
+
+#ifndef ARBITER_PATH
+#define ARBITER_PATH "/run/lock/debugcc"
+#endif
+
+#define ARBITER_MAGIC		"DCCARB"
+#define ARBITER_VERSION		1
+
+/* Waiters beyond this share queue slots, and may wait up to the timeout */
+#define ARBITER_QUEUE		64
+#define ARBITER_RESULTS		512
+
+/* Time after which a ticket drawn but never registered is skipped */
+#define ARBITER_STALE_US	1000000
+#define ARBITER_POLL_US		50
+
+struct arbiter_result {
+	char name[64];
+	/* Hash of the platform and the measurement path of the clock */
+	uint64_t key;
+	uint64_t rate;
+	/* CLOCK_MONOTONIC time of the measurement, in ns */
+	uint64_t timestamp;
+	uint32_t resolution;
+	int32_t error;
+	int32_t pid;
+	uint32_t reserved;
+};
+
+struct arbiter_file {
+	char magic[8];
+	uint32_t version;
+	/* Next ticket to draw, and ticket allowed to take the lock */
+	uint32_t next;
+	uint32_t serving;
+	uint32_t reserved;
+	/* ticket << 32 | pid of the waiters, pid 0 once given up */
+	uint64_t queue[ARBITER_QUEUE];
+	struct arbiter_result results[ARBITER_RESULTS];
+};
+
+static struct {
+	const char *path;
+	int fd;
+	struct arbiter_file *file;
+	const char *platform;
+
+	unsigned long timeout_us;
+	unsigned long reuse_us;
+
+	/* Request being served */
+	uint64_t requested;
+	unsigned int depth;
+} arbiter = {
+	.fd = -1,
+	.timeout_us = 5000000,
+};
+
+static uint64_t arbiter_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * arbiter_path() - use another lock file
+ * @path: lock file shared by the processes to arbitrate between
+ */
+void arbiter_path(const char *path)
+{
+	arbiter.path = path;
+}
+
+/**
+ * arbiter_timeout() - set the time to wait for the debug muxes
+ * @timeout_us: maximum time to wait for a turn
+ */
+void arbiter_timeout(unsigned long timeout_us)
+{
+	arbiter.timeout_us = timeout_us;
+}
+
+/**
+ * arbiter_reuse() - allow reusing results of other processes
+ * @age_us: maximum age of a result at the time it's requested
+ *
+ * Results measured by other processes while waiting for a turn are always
+ * reused.
+ */
+void arbiter_reuse(unsigned long age_us)
+{
+	arbiter.reuse_us = age_us;
+}
+
+/**
+ * arbiter_init() - open the lock file
+ * @platform: platform measured, results are only shared within it
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int arbiter_init(const struct debugcc_platform *platform)
+{
+	struct arbiter_file *file;
+	struct stat st;
+	int fd;
+
+	if (!arbiter.path)
+		arbiter.path = ARBITER_PATH;
+
+	fd = open(arbiter.path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		warn("failed to open %s", arbiter.path);
+		return -1;
+	}
+
+	/* The directory is commonly world-writable, anyone could have created it */
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+	    (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		warnx("%s is not a file owned and only writable by this user", arbiter.path);
+		close(fd);
+		return -1;
+	}
+
+	/* Growing the file is idempotent, it's zero filled until initialized */
+	if (ftruncate(fd, sizeof(*file)) < 0) {
+		warn("failed to size %s", arbiter.path);
+		close(fd);
+		return -1;
+	}
+
+	file = mmap(NULL, sizeof(*file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (file == MAP_FAILED) {
+		warn("failed to map %s", arbiter.path);
+		close(fd);
+		return -1;
+	}
+
+	if (memcmp(file->magic, ARBITER_MAGIC, sizeof(ARBITER_MAGIC))) {
+		flock(fd, LOCK_EX);
+		if (memcmp(file->magic, ARBITER_MAGIC, sizeof(ARBITER_MAGIC))) {
+			memset(file, 0, sizeof(*file));
+			file->version = ARBITER_VERSION;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			memcpy(file->magic, ARBITER_MAGIC, sizeof(ARBITER_MAGIC));
+		}
+		flock(fd, LOCK_UN);
+	}
+
+	if (file->version != ARBITER_VERSION) {
+		warnx("%s is in use by an incompatible debugcc", arbiter.path);
+		munmap(file, sizeof(*file));
+		close(fd);
+		return -1;
+	}
+
+	arbiter.fd = fd;
+	arbiter.file = file;
+	arbiter.platform = platform->name;
+
+	return 0;
+}
+
+static bool arbiter_alive(pid_t pid)
+{
+	return pid && (!kill(pid, 0) || errno != ESRCH);
+}
+
+/* Skip the ticket being served if its waiter is gone */
+static void arbiter_skip(uint32_t serving, uint64_t now, uint32_t *stale, uint64_t *since)
+{
+	uint64_t slot = __atomic_load_n(&arbiter.file->queue[serving % ARBITER_QUEUE],
+					__ATOMIC_ACQUIRE);
+	bool registered = (uint32_t)(slot >> 32) == serving;
+
+	if (registered && arbiter_alive((pid_t)(uint32_t)slot))
+		return;
+
+	if (!registered) {
+		/* Drawn, but possibly not yet registered */
+		if (*stale != serving) {
+			*stale = serving;
+			*since = now;
+		}
+
+		if (now - *since < ARBITER_STALE_US * 1000ULL)
+			return;
+	}
+
+	__atomic_compare_exchange_n(&arbiter.file->serving, &serving, serving + 1, false,
+				    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/**
+ * arbiter_acquire() - wait for the turn of this process to use the debug muxes
+ * @timeout_us: maximum time to wait, or 0 for the timeout set with
+ *		arbiter_timeout()
+ *
+ * Nested calls only count the depth, the turn lasts until the matching
+ * arbiter_release(). Without a lock file, always succeeds immediately. Other
+ * processes may have programmed the muxes before the turn, so the shadowed
+ * registers are read again.
+ *
+ * Callers working towards a deadline pass the time left, so waiting for a
+ * turn can't overrun it.
+ *
+ * Return: 0 on success, -EBUSY if the turn didn't come within the timeout
+ */
+int arbiter_acquire(unsigned long timeout_us)
+{
+	struct arbiter_file *file = arbiter.file;
+	uint64_t *slot;
+	uint64_t deadline;
+	uint32_t stale = 0;
+	uint64_t since = 0;
+	uint32_t serving;
+	uint32_t ticket;
+	uint64_t now;
+
+	if (arbiter.depth++)
+		return 0;
+
+	shadow_invalidate();
+
+	if (!file)
+		return 0;
+
+	now = arbiter_now();
+	arbiter.requested = now;
+	if (!timeout_us || timeout_us > arbiter.timeout_us)
+		timeout_us = arbiter.timeout_us;
+	deadline = now + timeout_us * 1000ULL;
+
+	ticket = __atomic_fetch_add(&file->next, 1, __ATOMIC_ACQ_REL);
+	slot = &file->queue[ticket % ARBITER_QUEUE];
+	__atomic_store_n(slot, (uint64_t)ticket << 32 | (uint32_t)getpid(), __ATOMIC_RELEASE);
+
+	for (;;) {
+		serving = __atomic_load_n(&file->serving, __ATOMIC_ACQUIRE);
+		if (serving == ticket && !flock(arbiter.fd, LOCK_EX | LOCK_NB))
+			return 0;
+
+		/* Skipped while stopped before registering, queue again */
+		if ((int32_t)(serving - ticket) > 0) {
+			ticket = __atomic_fetch_add(&file->next, 1, __ATOMIC_ACQ_REL);
+			slot = &file->queue[ticket % ARBITER_QUEUE];
+			__atomic_store_n(slot, (uint64_t)ticket << 32 | (uint32_t)getpid(),
+					 __ATOMIC_RELEASE);
+			continue;
+		}
+
+		now = arbiter_now();
+		if (now >= deadline)
+			break;
+
+		if (serving != ticket)
+			arbiter_skip(serving, now, &stale, &since);
+
+		usleep(ARBITER_POLL_US);
+	}
+
+	/* Give up the place in the queue, or the turn if it had come */
+	__atomic_store_n(slot, (uint64_t)ticket << 32, __ATOMIC_RELEASE);
+	serving = ticket;
+	__atomic_compare_exchange_n(&file->serving, &serving, ticket + 1, false,
+				    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+
+	arbiter.depth--;
+
+	return -EBUSY;
+}
+
+/**
+ * arbiter_release() - end the turn of this process
+ */
+void arbiter_release(void)
+{
+	struct arbiter_file *file = arbiter.file;
+
+	if (--arbiter.depth || !file)
+		return;
+
+	flock(arbiter.fd, LOCK_UN);
+
+	/* Waiters skipping dead tickets update it concurrently */
+	__atomic_fetch_add(&file->serving, 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t arbiter_hash(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--)
+		hash = (hash ^ *p++) * 1099511628211ULL;
+
+	return hash;
+}
+
+/* Identify the platform and the muxes and selectors measuring @clk */
+static uint64_t arbiter_key(const struct measure_clk *clk)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const struct debug_mux *mux;
+	unsigned long selector = clk->mux;
+
+	hash = arbiter_hash(hash, arbiter.platform, strlen(arbiter.platform));
+	hash = arbiter_hash(hash, &clk->fixed_div, sizeof(clk->fixed_div));
+
+	for (mux = clk->clk_mux; mux; mux = mux->parent) {
+		hash = arbiter_hash(hash, &mux->phys, sizeof(mux->phys));
+		hash = arbiter_hash(hash, &mux->mux_reg, sizeof(mux->mux_reg));
+		hash = arbiter_hash(hash, &selector, sizeof(selector));
+		hash = arbiter_hash(hash, &mux->div_val, sizeof(mux->div_val));
+		selector = mux->parent_mux_val;
+	}
+
+	return hash;
+}
+
+static struct arbiter_result *arbiter_slot(const struct measure_clk *clk, bool add)
+{
+	const char *name = clk->name;
+	struct arbiter_result *res;
+	uint64_t key = arbiter_key(clk);
+	uint32_t hash;
+	unsigned int i;
+
+	hash = arbiter_hash(key, name, strlen(name));
+
+	for (i = 0; i < ARBITER_RESULTS; i++) {
+		res = &arbiter.file->results[(hash + i) % ARBITER_RESULTS];
+
+		if (res->key == key && !strncmp(res->name, name, sizeof(res->name)))
+			return res;
+
+		if (!res->name[0])
+			break;
+	}
+
+	if (!add)
+		return NULL;
+
+	/* A full table evicts the clock's preferred slot */
+	if (i == ARBITER_RESULTS)
+		res = &arbiter.file->results[hash % ARBITER_RESULTS];
+
+	memset(res, 0, sizeof(*res));
+	strncpy(res->name, name, sizeof(res->name) - 1);
+	res->key = key;
+
+	return res;
+}
+
+/**
+ * arbiter_lookup() - reuse a recent result of another process
+ * @clk: clock to measure
+ * @m: result, if any
+ *
+ * Must be called during the turn of this process. The caller decides whether
+ * the resolution of the result is good enough.
+ *
+ * Return: true if @m was filled with a recent enough result
+ */
+bool arbiter_lookup(const struct measure_clk *clk, struct measurement *m)
+{
+	const struct arbiter_result *res;
+
+	if (!arbiter.file)
+		return false;
+
+	res = arbiter_slot(clk, false);
+	if (!res || !res->timestamp || res->pid == getpid() ||
+	    res->timestamp + arbiter.reuse_us * 1000ULL < arbiter.requested)
+		return false;
+
+	m->rate = res->rate;
+	m->resolution = res->resolution;
+	m->error = res->error;
+
+	return true;
+}
+
+/**
+ * arbiter_store() - share the result of a measurement with other processes
+ * @clk: clock measured
+ * @m: result of the measurement
+ *
+ * Must be called during the turn of this process.
+ */
+void arbiter_store(const struct measure_clk *clk, const struct measurement *m)
+{
+	struct arbiter_result *res;
+
+	if (!arbiter.file)
+		return;
+
+	res = arbiter_slot(clk, true);
+	res->rate = m->rate;
+	res->resolution = m->resolution;
+	res->error = m->error;
+	res->pid = getpid();
+	res->timestamp = arbiter_now();
+}
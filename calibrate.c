@@ -0,0 +1,245 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Calibration of the GCC debug counter
+ *
+ * measure_gcc() converts counter values to rates assuming a nominal XO
+ * reference rate and fixed start/stop latencies of the counter: 1.5 counts
+ * of the measured clock and 3.5 ticks of the XO reference. These dominate
+ * the error of short measurement windows, so they can instead be derived by
+ * measuring a reference clock of known rate, such as an XO branch, over a
+ * short and a long window. The elapsed time of the windows is measured
+ * against the ARM generic timer as well, which provides the XO reference
+ * rate if the rate of the reference clock isn't given.
+ *
+ * The results are stored per platform in CALIBRATION_DIR and loaded by
+ * subsequent runs.
+ */
+
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <debugcc.h>
+
+#ifndef CALIBRATION_DIR
+#define CALIBRATION_DIR "/var/cache/debugcc"
+#endif
+
+#define CAL_SAMPLES	8
+#define CAL_SHORT_TICKS	GCC_SHORT_TICKS
+#define CAL_LONG_TICKS	GCC_LONG_TICKS
+
+static const char *calibration_path(const struct debugcc_platform *platform)
+{
+	static char path[256];
+
+	snprintf(path, sizeof(path), "%s/%s.cal", CALIBRATION_DIR, platform->name);
+
+	return path;
+}
+
+/**
+ * calibration_load() - apply stored calibration of a platform
+ * @platform: debugcc_platform to load calibration data for
+ *
+ * Return: 0 on success or if the platform hasn't been calibrated, -1 on
+ * failure
+ */
+int calibration_load(const struct debugcc_platform *platform)
+{
+	const char *path = calibration_path(platform);
+	struct gcc_mux *gcc;
+	unsigned int xo_rate;
+	int count_offset;
+	int tick_offset;
+	FILE *fp;
+	int ret;
+
+	gcc = platform_gcc(platform);
+	if (!gcc)
+		return 0;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return errno == ENOENT ? 0 : -1;
+
+	ret = fscanf(fp, "%u %d %d", &xo_rate, &count_offset, &tick_offset);
+	fclose(fp);
+	if (ret != 3 || !xo_rate) {
+		warnx("malformed calibration data in %s", path);
+		return -1;
+	}
+
+	gcc->xo_rate = xo_rate;
+	gcc->count_offset = count_offset;
+	gcc->tick_offset = tick_offset;
+	gcc->calibrated = true;
+
+	return 0;
+}
+
+static int calibration_save(const struct debugcc_platform *platform,
+			    const struct gcc_mux *gcc)
+{
+	const char *path = calibration_path(platform);
+	char tmp[280];
+	FILE *fp;
+
+	if (mkdir(CALIBRATION_DIR, 0755) < 0 && errno != EEXIST) {
+		warn("failed to create %s", CALIBRATION_DIR);
+		return -1;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		warn("failed to create %s", tmp);
+		return -1;
+	}
+
+	fprintf(fp, "%u %d %d\n", gcc->xo_rate, gcc->count_offset, gcc->tick_offset);
+
+	if (fclose(fp) || rename(tmp, path) < 0) {
+		warn("failed to write %s", path);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Average count and elapsed generic timer ticks of a measurement window */
+static int calibration_sample(struct gcc_mux *gcc, unsigned int ticks,
+			      double *count, double *elapsed)
+{
+	uint64_t start;
+	uint64_t sum_count = 0;
+	uint64_t sum_elapsed = 0;
+	int ret;
+	int i;
+
+	for (i = 0; i < CAL_SAMPLES; i++) {
+		start = arch_counter();
+		ret = measure_ticks(gcc, ticks);
+		if (ret < 0)
+			return ret;
+
+		sum_count += ret;
+		sum_elapsed += arch_counter() - start;
+	}
+
+	*count = (double)sum_count / CAL_SAMPLES;
+	*elapsed = (double)sum_elapsed / CAL_SAMPLES;
+
+	return 0;
+}
+
+/**
+ * calibrate() - derive the debug counter corrections from a reference clock
+ * @platform: debugcc_platform to calibrate
+ * @ref: clock with a known, stable rate
+ * @ref_rate: rate of @ref in Hz, or 0 to rely on the generic timer
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int calibrate(const struct debugcc_platform *platform,
+	      const struct measure_clk *ref, unsigned long ref_rate)
+{
+	const struct debug_mux *mux;
+	struct gcc_mux *gcc;
+	double count_short, count_long;
+	double elapsed_short, elapsed_long;
+	double timer_xo_rate;
+	double xo_rate;
+	double rate;
+	double dt;
+	unsigned int div = 1;
+	uint32_t xo_div4;
+	int ret;
+
+	gcc = platform_gcc(platform);
+	if (!gcc) {
+		warnx("%s has no debug counter to calibrate", platform->name);
+		return -1;
+	}
+
+	for (mux = ref->clk_mux; mux; mux = mux->parent) {
+		if (mux->measure == measure_mccc) {
+			warnx("%s is not measured by the debug counter", ref->name);
+			return -1;
+		}
+
+		if (mux->div_val)
+			div *= mux->div_val;
+	}
+
+	if (ref->fixed_div)
+		div *= ref->fixed_div;
+
+	if (arbiter_acquire(0) < 0) {
+		warnx("debug counter busy");
+		return -1;
+	}
+
+	mux_prepare_enable(ref->clk_mux, ref->mux);
+	xo_div4 = gcc_counter_enable(gcc);
+
+	ret = calibration_sample(gcc, CAL_SHORT_TICKS, &count_short, &elapsed_short);
+	if (!ret)
+		ret = calibration_sample(gcc, CAL_LONG_TICKS, &count_long, &elapsed_long);
+
+	gcc_counter_disable(gcc, xo_div4);
+	mux_disable(ref->clk_mux);
+
+	arbiter_release();
+
+	if (ret < 0) {
+		warnx("debug counter failed: %s", strerror(-ret));
+		return -1;
+	}
+
+	if (count_long <= count_short || elapsed_long <= elapsed_short) {
+		warnx("reference clock %s is not running", ref->name);
+		return -1;
+	}
+
+	/* The polling overhead cancels out in the difference of the windows */
+	timer_xo_rate = (CAL_LONG_TICKS - CAL_SHORT_TICKS) * (double)arch_counter_freq() /
+			(elapsed_long - elapsed_short);
+
+	if (ref_rate) {
+		rate = (double)ref_rate / div;
+		xo_rate = rate * (CAL_LONG_TICKS - CAL_SHORT_TICKS) / (count_long - count_short);
+
+		if (xo_rate > timer_xo_rate * 1.01 || xo_rate < timer_xo_rate * 0.99)
+			warnx("reference rate of %.0fHz disagrees with the generic timer (%.0fHz)",
+			      xo_rate, timer_xo_rate);
+	} else {
+		xo_rate = timer_xo_rate;
+		rate = (count_long - count_short) * xo_rate / (CAL_LONG_TICKS - CAL_SHORT_TICKS);
+	}
+
+	/* Extension of the window, count + count_offset = rate * (ticks + dt) / xo_rate */
+	dt = (count_short + GCC_COUNT_OFFSET / 1000.0) * xo_rate / rate - CAL_SHORT_TICKS;
+	dt += (count_long + GCC_COUNT_OFFSET / 1000.0) * xo_rate / rate - CAL_LONG_TICKS;
+	dt /= 2;
+
+	gcc->xo_rate = xo_rate + 0.5;
+	gcc->count_offset = GCC_COUNT_OFFSET;
+	gcc->tick_offset = dt * 1000;
+	gcc->calibrated = true;
+
+	printf("%s: xo rate %uHz (generic timer %.0fHz), count offset %.3f, tick offset %.3f\n",
+	       platform->name, gcc->xo_rate, timer_xo_rate,
+	       gcc->count_offset / 1000.0, gcc->tick_offset / 1000.0);
+
+	return calibration_save(platform, gcc);
+}
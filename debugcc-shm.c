@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Reader of the shared memory table published by "debugcc -M"
+ *
+ * Built as a small library, independent of the rest of debugcc, for
+ * processes wanting the current rate of clocks without invoking debugcc.
+ * The table is mapped read-only and entries are read lock-free under their
+ * sequence count, so a read costs a handful of loads and never blocks the
+ * writer. Clock IDs are looked up by name once, and then used to read.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <debugcc-shm.h>
+
+struct debugcc_shm {
+	const struct debugcc_shm_header *header;
+	const struct debugcc_shm_entry *entries;
+	const char **names;
+	size_t size;
+};
+
+static bool debugcc_shm_valid(const struct debugcc_shm_header *header, size_t size)
+{
+	if (size < sizeof(*header) ||
+	    memcmp(header->magic, DEBUGCC_SHM_MAGIC, sizeof(DEBUGCC_SHM_MAGIC)) ||
+	    header->version != DEBUGCC_SHM_VERSION)
+		return false;
+
+	if (header->count > (size - sizeof(*header)) / sizeof(struct debugcc_shm_entry) ||
+	    header->names_offset < sizeof(*header) + header->count * sizeof(struct debugcc_shm_entry) ||
+	    header->names_offset > size || header->names_size > size - header->names_offset ||
+	    !header->names_size)
+		return false;
+
+	return memchr(header->platform, '\0', sizeof(header->platform)) &&
+	       ((const char *)header + header->names_offset)[header->names_size - 1] == '\0';
+}
+
+/**
+ * debugcc_shm_open() - map a published clock table
+ * @name: name of the POSIX shared memory object, as passed to "debugcc -M"
+ *
+ * Return: the table, or NULL if it doesn't exist or isn't valid
+ */
+struct debugcc_shm *debugcc_shm_open(const char *name)
+{
+	struct debugcc_shm *shm;
+	const char *names;
+	const char *end;
+	struct stat st;
+	unsigned int i;
+	void *base;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	if (!debugcc_shm_valid(base, st.st_size))
+		goto unmap;
+
+	shm = calloc(1, sizeof(*shm));
+	if (!shm)
+		goto unmap;
+
+	shm->header = base;
+	shm->entries = base + sizeof(*shm->header);
+	shm->size = st.st_size;
+
+	shm->names = calloc(shm->header->count, sizeof(*shm->names));
+	if (!shm->names)
+		goto free;
+
+	names = base + shm->header->names_offset;
+	end = names + shm->header->names_size;
+	for (i = 0; i < shm->header->count && names < end; i++) {
+		shm->names[i] = names;
+		names += strlen(names) + 1;
+	}
+	if (i < shm->header->count)
+		goto free;
+
+	return shm;
+
+free:
+	free(shm->names);
+	free(shm);
+unmap:
+	munmap(base, st.st_size);
+
+	return NULL;
+}
+
+/**
+ * debugcc_shm_close() - unmap a published clock table
+ * @shm: table to unmap
+ */
+void debugcc_shm_close(struct debugcc_shm *shm)
+{
+	munmap((void *)shm->header, shm->size);
+	free(shm->names);
+	free(shm);
+}
+
+/**
+ * debugcc_shm_platform() - name of the platform the table is published for
+ * @shm: clock table
+ *
+ * Return: name of the platform
+ */
+const char *debugcc_shm_platform(const struct debugcc_shm *shm)
+{
+	return shm->header->platform;
+}
+
+/**
+ * debugcc_shm_count() - number of clocks in the table
+ * @shm: clock table
+ *
+ * Return: number of clock IDs, whether published or not
+ */
+unsigned int debugcc_shm_count(const struct debugcc_shm *shm)
+{
+	return shm->header->count;
+}
+
+/**
+ * debugcc_shm_name() - name of a clock
+ * @shm: clock table
+ * @id: ID of the clock
+ *
+ * Return: name of the clock, or NULL if @id is out of range
+ */
+const char *debugcc_shm_name(const struct debugcc_shm *shm, unsigned int id)
+{
+	return id < shm->header->count ? shm->names[id] : NULL;
+}
+
+/**
+ * debugcc_shm_find() - look up the ID of a clock
+ * @shm: clock table
+ * @clk: name of the clock
+ *
+ * Return: ID of the clock, or -1 if there's no clock named @clk
+ */
+int debugcc_shm_find(const struct debugcc_shm *shm, const char *clk)
+{
+	unsigned int i;
+
+	for (i = 0; i < shm->header->count; i++) {
+		if (!strcmp(shm->names[i], clk))
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * debugcc_shm_read() - read the latest measurement of a clock
+ * @shm: clock table
+ * @id: ID of the clock
+ * @sample: latest measurement, with a CLOCK_MONOTONIC timestamp in ns
+ *
+ * Return: true if @sample was read, false if the clock hasn't been published
+ */
+bool debugcc_shm_read(const struct debugcc_shm *shm, unsigned int id,
+		      struct debugcc_shm_sample *sample)
+{
+	const struct debugcc_shm_entry *entry;
+	uint32_t flags;
+	uint32_t seq;
+
+	if (id >= shm->header->count)
+		return false;
+
+	entry = &shm->entries[id];
+
+	do {
+		do {
+			seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+		} while (seq & 1);
+
+		flags = __atomic_load_n(&entry->flags, __ATOMIC_RELAXED);
+		sample->rate = __atomic_load_n(&entry->rate, __ATOMIC_RELAXED);
+		sample->timestamp = __atomic_load_n(&entry->timestamp, __ATOMIC_RELAXED);
+		sample->error = __atomic_load_n(&entry->error, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq);
+
+	return flags & DEBUGCC_SHM_VALID;
+}
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef __DEBUGCC_SHM_H__
+#define __DEBUGCC_SHM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Layout of the shared memory table published by "debugcc -M", in the
+ * host's byte order:
+ *
+ *   struct debugcc_shm_header
+ *   struct debugcc_shm_entry entries[count]   indexed by clock ID
+ *   char names[names_size]                    NUL-terminated, in clock ID order
+ *
+ * Clock IDs are the indexes in the clock table of the platform, entries of
+ * clocks not published are never written. Each entry is guarded by its own
+ * sequence count, which the single writer increments before and after
+ * updating the entry; readers retry while it is odd or changed during their
+ * read.
+ */
+#define DEBUGCC_SHM_MAGIC	"DCCSHM"
+#define DEBUGCC_SHM_VERSION	1
+
+/* Set on entries holding a measurement */
+#define DEBUGCC_SHM_VALID	(1 << 0)
+
+struct debugcc_shm_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint32_t names_offset;
+	uint32_t names_size;
+	char platform[32];
+};
+
+struct debugcc_shm_entry {
+	uint32_t seq;
+	uint32_t flags;
+	uint64_t rate;
+	/* CLOCK_MONOTONIC time of the measurement, in ns */
+	uint64_t timestamp;
+	int32_t error;
+	uint32_t reserved;
+};
+
+/* Reader library, see debugcc-shm.c */
+struct debugcc_shm;
+
+struct debugcc_shm_sample {
+	uint64_t rate;
+	uint64_t timestamp;
+	int error;
+};
+
+struct debugcc_shm *debugcc_shm_open(const char *name);
+void debugcc_shm_close(struct debugcc_shm *shm);
+const char *debugcc_shm_platform(const struct debugcc_shm *shm);
+unsigned int debugcc_shm_count(const struct debugcc_shm *shm);
+const char *debugcc_shm_name(const struct debugcc_shm *shm, unsigned int id);
+int debugcc_shm_find(const struct debugcc_shm *shm, const char *clk);
+bool debugcc_shm_read(const struct debugcc_shm *shm, unsigned int id,
+		      struct debugcc_shm_sample *sample);
+
+#endif
@@ -16,110 +16,596 @@
 
 #include <debugcc.h>
 
-static unsigned int measure_ticks(struct gcc_mux *gcc, unsigned int ticks)
+const struct mmio_ops *mmio_ops;
+
+static int devmem_fd = -1;
+
+static void *devmem_map(struct debug_mux *mux)
 {
-	uint32_t val;
+	return mmap(0, mux->size, PROT_READ | PROT_WRITE, MAP_SHARED, devmem_fd, mux->phys);
+}
 
-	writel(ticks, gcc->mux.base + gcc->debug_ctl_reg);
-	do {
-		val = readl(gcc->mux.base + gcc->debug_status_reg);
-	} while (val & BIT(25));
+static uint32_t devmem_read(void *ptr)
+{
+	return *((volatile uint32_t *)ptr);
+}
+
+static void devmem_write(uint32_t val, void *ptr)
+{
+	*((volatile uint32_t *)ptr) = val;
+}
+
+static void devmem_barrier(enum mmio_barrier type)
+{
+	switch (type) {
+	case MMIO_RMB:
+		__mmio_rmb();
+		break;
+	case MMIO_WMB:
+		__mmio_wmb();
+		break;
+	default:
+		__mmio_mb();
+		break;
+	}
+}
+
+/* The hardware, as accessed directly while no backend is installed */
+static const struct mmio_ops devmem_ops = {
+	.map = devmem_map,
+	.read = devmem_read,
+	.write = devmem_write,
+	.barrier = devmem_barrier,
+};
+
+/**
+ * mmio_next() - backend to be wrapped by a new one
+ * @devmem: file descriptor to an opened /dev/mem, unless simulating
+ *
+ * Return: the installed backend, or the hardware if there's none
+ */
+const struct mmio_ops *mmio_next(int devmem)
+{
+	devmem_fd = devmem;
+
+	return mmio_ops ? : &devmem_ops;
+}
+
+/* arch_counter() time the current measurement must complete by, or 0 */
+static uint64_t measure_deadline;
+
+/* Set when the deadline cut the windows of the current measurement short */
+static bool measure_reduced;
 
-	writel(ticks | BIT(20), gcc->mux.base + gcc->debug_ctl_reg);
+/* Poll the counter status until BIT(25) equals @done, or @timeout passes */
+static int gcc_poll_status(struct gcc_mux *gcc, bool done, uint64_t timeout,
+			   uint32_t *val)
+{
 	do {
-		val = readl(gcc->mux.base + gcc->debug_status_reg);
-	} while (!(val & BIT(25)));
+		*val = readl_relaxed(gcc->mux.base + gcc->debug_status_reg);
+
+		/* A collapsed block reads as all ones */
+		if (*val == 0xffffffff)
+			return -EIO;
+
+		if (!!(*val & BIT(25)) == done)
+			return 0;
+	} while (arch_counter() < timeout);
+
+	return -ETIMEDOUT;
+}
+
+/**
+ * measure_ticks() - run the debug counter for a window of XO ticks
+ * @gcc: gcc_mux of the debug counter
+ * @ticks: length of the window
+ *
+ * Return: count of the measured clock in the window, -ETIMEDOUT if the
+ * counter didn't complete in time or -EIO if it isn't accessible
+ */
+int measure_ticks(struct gcc_mux *gcc, unsigned int ticks)
+{
+	enum stats_phase prev = stats_enter(STATS_MEASURE_TICKS);
+	unsigned int xo_rate = gcc->xo_rate ? : 4800000;
+	uint64_t freq = arch_counter_freq();
+	uint64_t window = (uint64_t)ticks * freq / xo_rate;
+	uint64_t now = arch_counter();
+	uint64_t timeout;
+	uint64_t limit;
+	uint32_t val;
+	int ret;
 
-	val &= 0x1ffffff;
+	timeout = now + 2 * window + GCC_TIMEOUT_US * freq / 1000000;
 
+	/* A stuck counter may use up the budget, but not beyond */
+	if (measure_deadline) {
+		limit = now + window + GCC_DEADLINE_SLACK_US * freq / 1000000;
+		if (measure_deadline > limit)
+			limit = measure_deadline;
+		if (timeout > limit)
+			timeout = limit;
+	}
+
+	/* Ordered, the mux programming must be visible before the counter runs */
 	writel(ticks, gcc->mux.base + gcc->debug_ctl_reg);
+	ret = gcc_poll_status(gcc, false, timeout, &val);
+	if (ret < 0)
+		goto out;
+
+	writel_relaxed(ticks | BIT(20), gcc->mux.base + gcc->debug_ctl_reg);
+
+	/* Make sure the counter has started before polling for completion */
+	mmio_mb();
+
+	ret = gcc_poll_status(gcc, true, timeout, &val);
+	mmio_rmb();
+
+	if (!ret)
+		ret = val & GCC_MAX_COUNT;
+
+out:
+	writel_relaxed(ticks, gcc->mux.base + gcc->debug_ctl_reg);
+
+	stats_leave(prev);
+
+	return ret;
+}
+
+#define SHADOW_MAX_REGS	32
 
-	return val;
+/*
+ * Shadow copies of the debug mux control registers. Each register is read
+ * once per measurement, subsequent read-modify-write cycles operate on the
+ * cached value and only the final value of a mux programming step is written
+ * out. Other processes and power collapse of a block may change the registers
+ * between measurements, so the cache is invalidated at the start of each
+ * measurement and each turn on the debug muxes.
+ */
+struct reg_shadow {
+	void *addr;
+	uint32_t val;
+};
+
+static struct reg_shadow shadow_regs[SHADOW_MAX_REGS];
+static unsigned int shadow_count;
+
+static struct reg_shadow *shadow_pending[SHADOW_MAX_REGS];
+static unsigned int shadow_npending;
+
+/**
+ * shadow_invalidate() - forget the cached register values
+ *
+ * Called at the start of a turn, before this process may access the muxes,
+ * so queued updates are dropped rather than written out. Each programming
+ * step flushes its own updates, leaving none queued between steps.
+ */
+void shadow_invalidate(void)
+{
+	shadow_npending = 0;
+	shadow_count = 0;
 }
 
-static void mux_prepare_enable(struct debug_mux *mux, int selector)
+static struct reg_shadow *shadow_lookup(void *addr)
+{
+	struct reg_shadow *reg;
+	unsigned int i;
+
+	for (i = 0; i < shadow_count; i++) {
+		if (shadow_regs[i].addr == addr)
+			return &shadow_regs[i];
+	}
+
+	if (shadow_count == SHADOW_MAX_REGS)
+		return NULL;
+
+	reg = &shadow_regs[shadow_count++];
+	reg->addr = addr;
+	reg->val = readl_relaxed(addr);
+
+	return reg;
+}
+
+static uint32_t shadow_read(void *addr)
+{
+	struct reg_shadow *reg;
+
+	reg = shadow_lookup(addr);
+	if (!reg)
+		return readl_relaxed(addr);
+
+	return reg->val;
+}
+
+/**
+ * shadow_update() - modify a shadowed register
+ * @addr: mapped address of the register
+ * @mask: bits to clear
+ * @bits: bits to set
+ * @write_through: store the value even if it matches the cached one
+ *
+ * The new value is only queued, shadow_flush() performs the actual store.
+ * Updates which don't change the cached value are dropped, unless
+ * @write_through is set for registers whose state this process can't assume.
+ */
+static void shadow_update(void *addr, uint32_t mask, uint32_t bits, bool write_through)
 {
+	struct reg_shadow *reg;
 	uint32_t val;
+	unsigned int i;
 
-	if (mux->mux_mask) {
-		val = readl(mux->base + mux->mux_reg);
-		val &= ~mux->mux_mask;
-		val |= selector << mux->mux_shift;
-		writel(val, mux->base + mux->mux_reg);
+	reg = shadow_lookup(addr);
+	if (!reg) {
+		/* Shadow table exhausted, fall back to a direct RMW */
+		val = readl_relaxed(addr);
+		writel_relaxed((val & ~mask) | bits, addr);
+		return;
 	}
 
-	if (mux->div_mask) {
-		val = readl(mux->base + mux->div_reg);
-		val &= ~mux->div_mask;
-		val |= (mux->div_val - 1) << mux->div_shift;
-		writel(val, mux->base + mux->div_reg);
+	val = (reg->val & ~mask) | bits;
+	if (val == reg->val && !write_through)
+		return;
+
+	reg->val = val;
+
+	for (i = 0; i < shadow_npending; i++) {
+		if (shadow_pending[i] == reg)
+			return;
 	}
 
+	shadow_pending[shadow_npending++] = reg;
+}
+
+/**
+ * shadow_flush() - write out queued register updates
+ *
+ * Registers are written in the order they were first modified, multiple
+ * updates of the same register are coalesced into a single store. The stores
+ * are relaxed, measure_ticks() orders them before starting the counter.
+ */
+static void shadow_flush(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < shadow_npending; i++)
+		writel_relaxed(shadow_pending[i]->val, shadow_pending[i]->addr);
+
+	shadow_npending = 0;
+}
+
+void mux_prepare_enable(struct debug_mux *mux, int selector)
+{
+	enum stats_phase prev = stats_enter(STATS_MUX_ENABLE);
+
+	if (mux->mux_mask)
+		shadow_update(mux->base + mux->mux_reg, mux->mux_mask,
+			      selector << mux->mux_shift, true);
+
+	if (mux->div_mask)
+		shadow_update(mux->base + mux->div_reg, mux->div_mask,
+			      (mux->div_val - 1) << mux->div_shift, false);
+
 	mux_enable(mux);
 
 	if (mux->parent)
 		mux_prepare_enable(mux->parent, mux->parent_mux_val);
+
+	stats_leave(prev);
 }
 
 void mux_enable(struct debug_mux *mux)
 {
-	uint32_t val;
+	if (mux->enable_mask)
+		shadow_update(mux->base + mux->enable_reg, 0, mux->enable_mask, true);
 
-	if (mux->enable_mask) {
-		val = readl(mux->base + mux->enable_reg);
-		val |= mux->enable_mask;
-		writel(val, mux->base + mux->enable_reg);
-	}
+	shadow_flush();
 }
 
 void mux_disable(struct debug_mux *mux)
 {
-	uint32_t val;
+	enum stats_phase prev = stats_enter(STATS_MUX_DISABLE);
 
 	if (mux->parent)
 		mux_disable(mux->parent);
 
-	if (mux->enable_mask) {
-		val = readl(mux->base + mux->enable_reg);
-		val &= ~mux->enable_mask;
-		writel(val, mux->base + mux->enable_reg);
+	if (mux->enable_mask)
+		shadow_update(mux->base + mux->enable_reg, mux->enable_mask, 0, true);
+
+	shadow_flush();
+
+	stats_leave(prev);
+}
+
+/**
+ * gcc_counter_enable() - enable the XO reference of the debug counter
+ * @gcc: gcc_mux of the counter
+ *
+ * Return: previous value of the XO div4 branch control, to be passed to
+ * gcc_counter_disable()
+ */
+uint32_t gcc_counter_enable(struct gcc_mux *gcc)
+{
+	void *reg = gcc->mux.base + gcc->xo_div4_reg;
+	uint32_t xo_div4;
+
+	xo_div4 = shadow_read(reg);
+	if (gcc->xo_div4_val)
+		shadow_update(reg, 0, gcc->xo_div4_val, false);
+	else
+		shadow_update(reg, 0, 1, false);
+	shadow_flush();
+
+	return xo_div4;
+}
+
+void gcc_counter_disable(struct gcc_mux *gcc, uint32_t xo_div4)
+{
+	shadow_update(gcc->mux.base + gcc->xo_div4_reg, ~0U, xo_div4, false);
+	shadow_flush();
+}
+
+/**
+ * gcc_count_to_rate() - convert a debug counter value to a rate
+ * @gcc: gcc_mux of the counter
+ * @count: counter value, summed over all windows
+ * @ticks: length of each measurement window, in XO reference cycles
+ * @windows: number of measurement windows
+ *
+ * Applies the counter start/stop latency corrections, either the
+ * calibrated ones or the nominal 1.5 counts and 3.5 ticks, once per window.
+ *
+ * Return: rate of the clock at the counter input, in Hz
+ */
+uint64_t gcc_count_to_rate(const struct gcc_mux *gcc, uint64_t count,
+			   unsigned int ticks, unsigned int windows)
+{
+	int64_t count_offset = GCC_COUNT_OFFSET;
+	int64_t tick_offset = GCC_TICK_OFFSET;
+	unsigned int xo_rate = 4800000;
+
+	if (gcc->xo_rate)
+		xo_rate = gcc->xo_rate;
+
+	if (gcc->calibrated) {
+		count_offset = gcc->count_offset;
+		tick_offset = gcc->tick_offset;
 	}
+
+	return ((int64_t)(count * 1000) + windows * count_offset) * xo_rate /
+	       (((int64_t)ticks * 1000 + tick_offset) * windows);
+}
+
+static const struct measure_config measure_presets[] = {
+	{
+		.name = "fast",
+		.short_ticks = 0x400,
+		.long_ticks = 0x2000,
+		.samples = 1,
+		.min_count = 100,
+		.max_ticks = 0x2000,
+	},
+	{
+		.name = "default",
+		.short_ticks = GCC_SHORT_TICKS,
+		.long_ticks = GCC_LONG_TICKS,
+		.samples = 1,
+		.min_count = 1000,
+		.max_ticks = 8 * GCC_MAX_TICKS,
+	},
+	{
+		.name = "precise",
+		.short_ticks = GCC_SHORT_TICKS,
+		.long_ticks = GCC_MAX_TICKS,
+		.samples = 4,
+		.min_count = 1000000,
+		.max_ticks = 16 * GCC_MAX_TICKS,
+	},
+	{
+		/*
+		 * The short window alone, for sampling clocks repeatedly, which
+		 * measure_sample_ticks() lengthens for slow clocks
+		 */
+		.name = "sample",
+		.short_ticks = 0x400,
+		.min_count = 100,
+		.max_ticks = GCC_LONG_TICKS,
+	},
+	{}
+};
+
+struct measure_config measure_config = {
+	.name = "default",
+	.short_ticks = GCC_SHORT_TICKS,
+	.long_ticks = GCC_LONG_TICKS,
+	.samples = 1,
+	.min_count = 1000,
+	.max_ticks = 8 * GCC_MAX_TICKS,
+};
+
+const struct measure_config *measure_preset(const char *name)
+{
+	const struct measure_config *preset;
+
+	for (preset = measure_presets; preset->name; preset++) {
+		if (!strcmp(preset->name, name))
+			return preset;
+	}
+
+	return NULL;
+}
+
+/**
+ * measure_config_preset() - select a measurement preset
+ * @name: name of the preset, "fast", "default", "precise" or "sample"
+ *
+ * Replaces the current measurement configuration, retaining the time budget.
+ *
+ * Return: 0 on success, -1 if no preset named @name exists
+ */
+int measure_config_preset(const char *name)
+{
+	const struct measure_config *preset;
+	unsigned long budget_us = measure_config.budget_us;
+
+	preset = measure_preset(name);
+	if (!preset)
+		return -1;
+
+	measure_config = *preset;
+	measure_config.budget_us = budget_us;
+
+	return 0;
+}
+
+/**
+ * measure_config_cost() - nominal time spent measuring a clock
+ * @cfg: measurement configuration
+ * @gcc: gcc_mux of the debug counter
+ *
+ * Return: the time taken by the counter windows in microseconds, ignoring
+ * adjustments for the rate of the clock
+ */
+unsigned long measure_config_cost(const struct measure_config *cfg,
+				  const struct gcc_mux *gcc)
+{
+	unsigned int xo_rate = gcc && gcc->xo_rate ? gcc->xo_rate : 4800000;
+	uint64_t ticks;
+
+	ticks = cfg->short_ticks + (uint64_t)cfg->long_ticks * cfg->samples;
+
+	return ticks * 1000000 / xo_rate;
+}
+
+/**
+ * measure_config_budget() - limit the time spent measuring each clock
+ * @budget_us: time budget in microseconds, or 0 for no limit
+ *
+ * The budget covers waiting for a turn on the debug muxes and the counter
+ * windows, a counter failing to complete gives up when it runs out. The mux
+ * programming is not accounted for.
+ */
+void measure_config_budget(unsigned long budget_us)
+{
+	measure_config.budget_us = budget_us;
+}
+
+/*
+ * Pick the length and number of the measurement windows, based on the count
+ * of the short window. Fast clocks get a shorter window to keep the counter
+ * from wrapping, slow clocks get a longer one, or several chained windows
+ * when even the longest window gives too few counts.
+ */
+static unsigned int gcc_window(const struct gcc_mux *gcc, uint64_t count_short,
+			       unsigned int *windows)
+{
+	const struct measure_config *cfg = &measure_config;
+	unsigned int xo_rate = gcc->xo_rate ? : 4800000;
+	uint64_t max_ticks = cfg->max_ticks;
+	uint64_t min_ticks = 2 * cfg->short_ticks;
+	uint64_t ticks = cfg->long_ticks;
+	uint64_t budget;
+	uint64_t needed;
+	uint64_t now;
+
+	*windows = cfg->samples;
+
+	if (!count_short) {
+		/* Nothing to go by, stick to the nominal window */
+	} else if (count_short * ticks / cfg->short_ticks > GCC_COUNT_LIMIT) {
+		ticks = (uint64_t)cfg->short_ticks * GCC_COUNT_LIMIT / count_short;
+	} else if (count_short * ticks * *windows / cfg->short_ticks < cfg->min_count) {
+		needed = (uint64_t)cfg->short_ticks * cfg->min_count / count_short;
+		if (needed > (uint64_t)GCC_MAX_TICKS * *windows) {
+			ticks = GCC_MAX_TICKS;
+			*windows = (needed + GCC_MAX_TICKS - 1) / GCC_MAX_TICKS;
+		} else {
+			ticks = (needed + *windows - 1) / *windows;
+		}
+	}
+
+	/* What's left of the budget after waiting for the turn and the short window */
+	if (measure_deadline) {
+		now = arch_counter();
+		budget = measure_deadline > now ? measure_deadline - now : 0;
+		budget = budget * xo_rate / arch_counter_freq();
+		if (budget < max_ticks)
+			max_ticks = budget;
+		if (budget < ticks * *windows)
+			measure_reduced = true;
+	}
+
+	/* The long window must differ from the short one, to detect stopped clocks */
+	if (max_ticks < min_ticks)
+		max_ticks = min_ticks;
+
+	if (ticks > max_ticks)
+		ticks = max_ticks;
+	if (ticks < min_ticks)
+		ticks = min_ticks;
+
+	if (ticks * *windows > max_ticks)
+		*windows = max_ticks / ticks;
+
+	return ticks;
 }
 
 unsigned long measure_gcc(const struct measure_clk *clk,
 			  const struct debug_mux *mux)
 {
-	unsigned int xo_rate = 4800000;
 	uint64_t raw_count_short;
-	uint64_t raw_count_full;
+	uint64_t raw_count_full = 0;
 	struct gcc_mux *gcc = container_of(mux, struct gcc_mux, mux);
-	unsigned long xo_div4;
+	unsigned int windows;
+	unsigned int ticks;
+	unsigned int i;
+	uint32_t xo_div4;
+	int ret;
 
-	if (gcc->xo_rate)
-		xo_rate = gcc->xo_rate;
+	xo_div4 = gcc_counter_enable(gcc);
 
-	xo_div4 = readl(mux->base + gcc->xo_div4_reg);
-	if (gcc->xo_div4_val)
-		writel(xo_div4 | gcc->xo_div4_val, mux->base + gcc->xo_div4_reg);
-	else
-		writel(xo_div4 | 1, mux->base + gcc->xo_div4_reg);
+	ret = measure_ticks(gcc, measure_config.short_ticks);
+	if (ret < 0)
+		goto fault;
+	raw_count_short = ret;
+
+	if (measure_config.samples) {
+		ticks = gcc_window(gcc, raw_count_short, &windows);
+		for (i = 0; i < windows; i++) {
+			ret = measure_ticks(gcc, ticks);
+			if (ret < 0)
+				goto fault;
+			raw_count_full += ret;
+		}
+	} else {
+		ticks = measure_config.short_ticks;
+		windows = 1;
+		raw_count_full = raw_count_short;
+	}
 
-	raw_count_short = measure_ticks(gcc, 0x1000);
-	raw_count_full = measure_ticks(gcc, 0x10000);
+	gcc_counter_disable(gcc, xo_div4);
 
-	writel(xo_div4, mux->base + gcc->xo_div4_reg);
+	gcc->count = raw_count_full;
 
-	if (raw_count_full == raw_count_short) {
+	/* A stopped clock leaves the counter unchanged between windows */
+	if (!raw_count_full ||
+	    (measure_config.samples && raw_count_full == raw_count_short)) {
 		return 0;
 	}
 
-	raw_count_full = ((raw_count_full * 10) + 15) * xo_rate;
-	raw_count_full = raw_count_full / ((0x10000 * 10) + 35);
+	raw_count_full = gcc_count_to_rate(gcc, raw_count_full, ticks, windows);
 
 	if (mux->div_val)
 		raw_count_full *= mux->div_val;
 
 	return raw_count_full;
+
+fault:
+	/* Don't bother with further windows once the counter failed */
+	gcc_counter_disable(gcc, xo_div4);
+
+	gcc->count = 0;
+	gcc->error = ret;
+
+	return 0;
 }
 
 unsigned long measure_leaf(const struct measure_clk *clk,
@@ -147,25 +633,250 @@ unsigned long measure_mccc(const struct measure_clk *clk,
 	return 1000000000000ULL / readl(clk->clk_mux->base + clk->mux);
 }
 
-static void measure(const struct measure_clk *clk)
+/* The GCC debug counter measuring @clk, if any */
+static struct gcc_mux *clock_gcc(const struct measure_clk *clk)
+{
+	const struct debug_mux *mux;
+
+	for (mux = clk->clk_mux; mux->parent; mux = mux->parent)
+		;
+
+	if (mux->measure != measure_gcc)
+		return NULL;
+
+	return container_of(mux, struct gcc_mux, mux);
+}
+
+/*
+ * The resolution of a measurement is one count of the debug counter, for
+ * clocks measured by other means none is reported.
+ */
+static unsigned long measure_resolution(const struct measure_clk *clk,
+					unsigned long rate)
+{
+	struct gcc_mux *gcc = clock_gcc(clk);
+
+	if (!gcc || !gcc->count)
+		return 0;
+
+	return (rate + gcc->count - 1) / gcc->count;
+}
+
+/* Ratio of the rate of @clk to the rate counted by the debug counter */
+static unsigned int clock_div(const struct measure_clk *clk)
 {
+	const struct debug_mux *mux;
+	unsigned int div = 1;
+
+	for (mux = clk->clk_mux; mux; mux = mux->parent) {
+		if (mux->div_val)
+			div *= mux->div_val;
+	}
+
+	if (clk->fixed_div)
+		div *= clk->fixed_div;
+
+	return div;
+}
+
+/*
+ * The resolution a measurement of @clk running at @rate would get with the
+ * current configuration and the time left, to tell whether a result shared
+ * by another process is good enough.
+ */
+static unsigned long measure_expected_resolution(const struct measure_clk *clk,
+						 unsigned long rate)
+{
+	struct gcc_mux *gcc = clock_gcc(clk);
+	unsigned int div = clock_div(clk);
+	unsigned int windows = 1;
+	unsigned int ticks;
+	unsigned int xo_rate;
+	uint64_t count;
+
+	if (!gcc || !rate)
+		return 0;
+
+	xo_rate = gcc->xo_rate ? : 4800000;
+	count = (uint64_t)rate / div * measure_config.short_ticks / xo_rate;
+
+	if (measure_config.samples) {
+		ticks = gcc_window(gcc, count, &windows);
+		count = (uint64_t)rate / div * ticks * windows / xo_rate;
+	}
+
+	return count ? (rate + count - 1) / count : rate;
+}
+
+/* Take a result shared by another process, if as good as measuring now */
+static bool measure_shared(const struct measure_clk *clk, struct measurement *m)
+{
+	struct measurement shared = {};
+
+	if (!arbiter_lookup(clk, &shared))
+		return false;
+
+	if (!shared.error && shared.rate &&
+	    shared.resolution > measure_expected_resolution(clk, shared.rate))
+		return false;
+
+	m->rate = shared.rate;
+	m->resolution = shared.resolution;
+	m->error = shared.error;
+
+	return true;
+}
+
+/**
+ * measure_sample_ticks() - window to sample a clock with
+ * @clk: clock to be sampled
+ * @rate: rate of @clk as measured beforehand, or 0 if it was off
+ * @resolution: resolution of the samples, the rate counting once per window
+ *
+ * The "sample" preset counts a single short window, in which clocks slower
+ * than the XO rate over the window count nothing and read as off. The window
+ * is lengthened for @clk to count the min_count of the preset, up to its
+ * max_ticks. Clocks which were off are given the longest window, as nothing
+ * tells whether they run slow once on.
+ *
+ * Return: the window in ticks, to be used as short_ticks of the preset
+ */
+unsigned int measure_sample_ticks(const struct measure_clk *clk, unsigned long rate,
+				  unsigned long *resolution)
+{
+	const struct measure_config *cfg = measure_preset("sample");
+	struct gcc_mux *gcc = clock_gcc(clk);
+	unsigned int div = clock_div(clk);
+	unsigned int xo_rate;
+	uint64_t ticks;
+
+	if (!gcc) {
+		*resolution = 0;
+		return cfg->short_ticks;
+	}
+
+	xo_rate = gcc->xo_rate ? : 4800000;
+
+	if (rate)
+		ticks = (uint64_t)cfg->min_count * div * xo_rate / rate;
+	else
+		ticks = cfg->max_ticks;
+
+	if (ticks < cfg->short_ticks)
+		ticks = cfg->short_ticks;
+	if (ticks > cfg->max_ticks)
+		ticks = cfg->max_ticks;
+
+	*resolution = ((uint64_t)div * xo_rate + ticks - 1) / ticks;
+
+	return ticks;
+}
+
+/**
+ * measure_clock() - measure the rate of a clock
+ * @clk: clock to measure
+ * @m: measurement result
+ */
+void measure_clock(const struct measure_clk *clk, struct measurement *m)
+{
+	struct gcc_mux *gcc = clock_gcc(clk);
+	enum stats_phase prev;
 	unsigned long clk_rate;
+	uint64_t start;
+	int ret;
+
+	if (measure_config.budget_us)
+		measure_deadline = arch_counter() +
+				   measure_config.budget_us * arch_counter_freq() / 1000000;
+
+	ret = arbiter_acquire(measure_config.budget_us);
+	if (ret < 0) {
+		measure_deadline = 0;
+		m->rate = 0;
+		m->resolution = 0;
+		m->error = ret;
+		return;
+	}
+
+	if (measure_shared(clk, m)) {
+		measure_deadline = 0;
+		arbiter_release();
+		timeline_sample(clk, m, arch_counter());
+		return;
+	}
+
+	shadow_invalidate();
+	measure_reduced = false;
+
+	stats_clock_begin();
+	sim_clock_begin(clk);
+	start = arch_counter();
+
+	if (gcc)
+		gcc->error = 0;
 
 	mux_prepare_enable(clk->clk_mux, clk->mux);
 
+	prev = stats_enter(STATS_MEASURE);
 	clk_rate = clk->clk_mux->measure(clk, clk->clk_mux);
+	stats_leave(prev);
 
 	if (clk->fixed_div)
 		clk_rate *= clk->fixed_div;
 
 	mux_disable(clk->clk_mux);
 
-	if (clk_rate == 0) {
-		printf("%50s: off\n", clk->name);
-		return;
-	}
+	measure_deadline = 0;
+
+	m->rate = clk_rate;
+	m->resolution = clk_rate ? measure_resolution(clk, clk_rate) : 0;
+	m->error = gcc ? gcc->error : 0;
+	if (measure_reduced)
+		m->flags |= MEASURE_REDUCED;
 
-	printf("%50s: %fMHz (%ldHz)\n", clk->name, clk_rate / 1000000.0, clk_rate);
+	stats_clock_end(clk);
+	sim_clock_end();
+
+	arbiter_store(clk, m);
+	arbiter_release();
+
+	/* The rate is the average over the measurement */
+	timeline_sample(clk, m, start + (arch_counter() - start) / 2);
+}
+
+void print_measurement(const struct measure_clk *clk, const struct measurement *m)
+{
+	enum stats_phase prev = stats_enter(STATS_OUTPUT);
+	const char *reduced = m->flags & MEASURE_REDUCED ? " [reduced]" : "";
+	const char *expected = "";
+
+	if (m->flags & MEASURE_UNEXPECTED)
+		expected = " [unexpected]";
+	else if (m->flags & MEASURE_REQUIRED)
+		expected = " [off but required]";
+
+	if (m->flags & MEASURE_SKIPPED)
+		printf("%50s: skipped\n", clk->name);
+	else if (m->error)
+		printf("%50s: fault (%s)%s%s\n", clk->name, strerror(-m->error), reduced, expected);
+	else if (m->rate == 0)
+		printf("%50s: off%s%s\n", clk->name, reduced, expected);
+	else if (m->resolution)
+		printf("%50s: %fMHz (%ldHz +/- %luHz)%s%s\n", clk->name,
+		       m->rate / 1000000.0, m->rate, m->resolution, reduced, expected);
+	else
+		printf("%50s: %fMHz (%ldHz)%s%s\n", clk->name, m->rate / 1000000.0,
+		       m->rate, reduced, expected);
+
+	stats_leave(prev);
+}
+
+static void measure(const struct measure_clk *clk)
+{
+	struct measurement m = {};
+
+	measure_clock(clk, &m);
+	print_measurement(clk, &m);
 }
 
 static const struct debugcc_platform *find_platform(const char *name)
@@ -206,20 +917,53 @@ static const struct debugcc_platform *match_platform(const char *argv)
 	return NULL;
 }
 
-static const struct measure_clk *find_clock(const struct debugcc_platform *platform,
-					    const char *name)
+/**
+ * platform_gcc() - find the GCC debug counter of a platform
+ * @platform: debugcc_platform to search
+ *
+ * Return: the gcc_mux at the root of the platform's debug muxes, or NULL
+ */
+struct gcc_mux *platform_gcc(const struct debugcc_platform *platform)
 {
-	const struct measure_clk *clk;
-
-	for (clk = platform->clocks; clk->name; clk++) {
-		if (!strcmp(clk->name, name))
-			return clk;
+	const struct clock_table *table = platform->clocks;
+	struct debug_mux *mux;
+	unsigned int i;
+
+	for (i = 0; i < table->nmuxes; i++) {
+		for (mux = table->muxes[i]; mux; mux = mux->parent) {
+			if (mux->measure == measure_gcc)
+				return container_of(mux, struct gcc_mux, mux);
+		}
 	}
 
 	return NULL;
 }
 
-static bool clock_from_block(const struct measure_clk *clk, const char *block_name)
+/**
+ * find_clock() - look up a clock by name
+ * @platform: debugcc_platform to search
+ * @name: name of the clock
+ * @clk: unpacked clock, if found
+ *
+ * Return: index of the clock in the platform's table, or -1 if not found
+ */
+int find_clock(const struct debugcc_platform *platform, const char *name,
+	       struct measure_clk *clk)
+{
+	const struct clock_table *table = platform->clocks;
+	unsigned int i;
+
+	for (i = 0; i < table->count; i++) {
+		if (!strcmp(table->names + table->entries[i].name, name)) {
+			platform_clock(platform, i, clk);
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+bool clock_from_block(const struct measure_clk *clk, const char *block_name)
 {
 	return  !block_name ||
 		(!clk->clk_mux && !strcmp(block_name, CORE_CC_BLOCK)) ||
@@ -228,27 +972,78 @@ static bool clock_from_block(const struct measure_clk *clk, const char *block_na
 
 static void list_clocks_block(const struct debugcc_platform *platform, const char *block_name)
 {
-	const struct measure_clk *clk;
+	struct measure_clk clk;
+	unsigned int i;
 
-	for (clk = platform->clocks; clk->name; clk++) {
-		if (!clock_from_block(clk, block_name))
+	for (i = 0; i < platform_nclocks(platform); i++) {
+		platform_clock(platform, i, &clk);
+
+		if (!clock_from_block(&clk, block_name))
 			continue;
 
-		if (clk->clk_mux && clk->clk_mux->block_name)
-			printf("%-40s %s\n", clk->name, clk->clk_mux->block_name);
+		if (clk.clk_mux && clk.clk_mux->block_name)
+			printf("%-40s %s\n", clk.name, clk.clk_mux->block_name);
 		else
-			printf("%s\n", clk->name);
+			printf("%s\n", clk.name);
 	}
 }
 
+/*
+ * Look up the clocks named on the command line, or all clocks of @block_name
+ * if none are, for modes measuring a set of clocks. The indexes of the clocks
+ * in the platform's clock table are returned in @indexes, if not NULL.
+ */
+static struct measure_clk *find_clocks(const struct debugcc_platform *platform,
+				       const char *block_name, char **names, unsigned int count,
+				       unsigned int **indexes, unsigned int *nclks)
+{
+	unsigned int *idx;
+	struct measure_clk *clks;
+	unsigned int n = 0;
+	unsigned int i;
+	int ret;
+
+	clks = calloc(count ? : platform_nclocks(platform), sizeof(*clks));
+	idx = calloc(count ? : platform_nclocks(platform), sizeof(*idx));
+	if (!clks || !idx)
+		err(1, "failed to allocate clocks");
+
+	if (count) {
+		for (n = 0; n < count; n++) {
+			ret = find_clock(platform, names[n], &clks[n]);
+			if (ret < 0) {
+				fprintf(stderr, "no clock named \"%s\"\n", names[n]);
+				exit(1);
+			}
+			idx[n] = ret;
+		}
+	} else {
+		for (i = 0; i < platform_nclocks(platform); i++) {
+			platform_clock(platform, i, &clks[n]);
+			idx[n] = i;
+
+			if (clock_from_block(&clks[n], block_name))
+				n++;
+		}
+	}
+
+	if (indexes)
+		*indexes = idx;
+	else
+		free(idx);
+	*nclks = n;
+
+	return clks;
+}
+
 int mmap_mux(int devmem, struct debug_mux *mux)
 {
 	/* Do nothing if this mux has already been mapped */
 	if (!mux || mux->base)
 		return 0;
 
-	mux->base = mmap(0, mux->size, PROT_READ | PROT_WRITE, MAP_SHARED, devmem, mux->phys);
-	if (mux->base == (void *)-1) {
+	mux->base = mmio_next(devmem)->map(mux);
+	if (!mux->base || mux->base == (void *)-1) {
 		warn("failed to map %#lx", mux->phys);
 		return -1;
 	}
@@ -257,32 +1052,78 @@ int mmap_mux(int devmem, struct debug_mux *mux)
 }
 
 /**
- * mmap_hardware() - loop over all clock and make sure hardware is mmapped
+ * mmap_hardware() - loop over all debug muxes and make sure hardware is mmapped
  * @devmem: file descriptor to an opened /dev/mem
- * @platform: debugcc_platform with list of clocks to mmap
+ * @platform: debugcc_platform with list of debug muxes to mmap
  *
  * Return: 0 on succees, -1 on failure
  */
 static int mmap_hardware(int devmem, const struct debugcc_platform *platform)
 {
-	const struct measure_clk *clk;
-	int ret;
+	enum stats_phase prev = stats_enter(STATS_MMAP);
+	const struct clock_table *table = platform->clocks;
+	unsigned int i;
+	int ret = 0;
 
-	for (clk = platform->clocks; clk->name; clk++) {
-		ret = mmap_mux(devmem, clk->clk_mux);
+	for (i = 0; i < table->nmuxes; i++) {
+		ret = mmap_mux(devmem, table->muxes[i]);
 		if (ret < 0)
-			return ret;
+			break;
 	}
 
-	return 0;
+	stats_leave(prev);
+
+	return ret;
 }
 
 static void usage(void)
 {
 	const struct debugcc_platform **p;
 
-	fprintf(stderr, "debugcc <-p platform> [-b blk] <-a | -l | clk>\n");
-	fprintf(stderr, "<platform>-debugcc [-b blk] <-a | -l | clk>\n");
+	fprintf(stderr, "debugcc [-p platform] [options] <-a | -l | -c ref[=rate] | clk>\n");
+	fprintf(stderr, "<platform>-debugcc [options] <-a | -l | -c ref[=rate] | clk>\n");
+	fprintf(stderr, "options:\n");
+	fprintf(stderr, "  -b, --block <blk>          limit to clocks of block <blk>\n");
+	fprintf(stderr, "  -f, --file <file>          load the platform from a description file\n");
+	fprintf(stderr, "  -r, --root <dir>           detect the platform from <dir>/sys and <dir>/proc\n");
+	fprintf(stderr, "  -n, --dry-run              print the register accesses and estimated time\n");
+	fprintf(stderr, "  -R, --replay <file>        run against a trace recorded with -t\n");
+	fprintf(stderr, "  -m, --fake-devmem          run against memory standing in for /dev/mem\n");
+	fprintf(stderr, "  -s, --simulate             run against simulated hardware\n");
+	fprintf(stderr, "  -F, --fault <fault>        inject a fault into the simulation\n");
+	fprintf(stderr, "  -S, --stats                print time and register accesses per phase\n");
+	fprintf(stderr, "  -t, --trace <file>         record all register accesses to <file>\n");
+	fprintf(stderr, "  -P, --preset <preset>      fast, default, precise or sample measurements\n");
+	fprintf(stderr, "  -T, --clock-budget <ms>    limit the measurement time of each clock\n");
+	fprintf(stderr, "  -B, --budget <ms>          complete the sweep within <ms>\n");
+	fprintf(stderr, "  -d, --sample <ms>          sample a directly read clock for <ms>, or\n");
+	fprintf(stderr, "                             wait at most <ms> for a trigger\n");
+	fprintf(stderr, "  -D, --decimate <n>         keep only every <n>th sample\n");
+	fprintf(stderr, "  -g, --trigger <cond>[:<pre>[:<post>]]\n");
+	fprintf(stderr, "                             sample the given clocks until one meets <cond>,\n");
+	fprintf(stderr, "                             change, on, off, ><rate> or <<rate>, and print\n");
+	fprintf(stderr, "                             <pre> and <post> samples around it\n");
+	fprintf(stderr, "  -u, --residency <ms>       sample the given clocks for <ms> and print the\n");
+	fprintf(stderr, "                             share of time spent on and at each rate\n");
+	fprintf(stderr, "  -e, --expect <file>        classify the sweep against the expected rates in <file>\n");
+	fprintf(stderr, "  -k, --check                stop the sweep at the first unexpected rate\n");
+	fprintf(stderr, "  -w, --export <file>        measure periodically, publishing a Prometheus textfile\n");
+	fprintf(stderr, "  -M, --shm <name>           measure periodically, publishing into shared memory\n");
+	fprintf(stderr, "  -I, --interval <ms>        period of the exported measurements\n");
+	fprintf(stderr, "  -o, --save <file>          save the results of the sweep as a snapshot\n");
+	fprintf(stderr, "  -x, --diff <file>          print clocks of the sweep failed from the\n");
+	fprintf(stderr, "                             snapshot, given again compare snapshots instead\n");
+	fprintf(stderr, "  -z, --tolerance [<clk>=]<tol>\n");
+	fprintf(stderr, "                             allowed deviation in Hz, %% or ppm\n");
+	fprintf(stderr, "  -i, --important <clk,...>  clocks to prioritize within the budget\n");
+	fprintf(stderr, "  -j, --timeline <file>      write measurements as a Chrome JSON trace\n");
+	fprintf(stderr, "  -L, --lock <file>          take turns with other processes through <file>\n");
+	fprintf(stderr, "  -W, --lock-timeout <ms>    wait at most <ms> for a turn\n");
+	fprintf(stderr, "  -A, --reuse <ms>           reuse results of other processes up to <ms> old\n");
+
+#ifndef DEBUGCC_DIAGNOSTICS
+	fprintf(stderr, "built without diagnostics, -n, -R, -m, -s, -F, -S and -t are unavailable\n");
+#endif
 
 	fprintf(stderr, "available platforms:");
 	for (p = platforms; *p; p++)
@@ -292,18 +1133,91 @@ static void usage(void)
 	exit(0);
 }
 
+static const struct option options[] = {
+	{ "all", no_argument, NULL, 'a' },
+	{ "block", required_argument, NULL, 'b' },
+	{ "calibrate", required_argument, NULL, 'c' },
+	{ "file", required_argument, NULL, 'f' },
+	{ "list", no_argument, NULL, 'l' },
+	{ "dry-run", no_argument, NULL, 'n' },
+	{ "platform", required_argument, NULL, 'p' },
+	{ "replay", required_argument, NULL, 'R' },
+	{ "root", required_argument, NULL, 'r' },
+	{ "fake-devmem", no_argument, NULL, 'm' },
+	{ "simulate", no_argument, NULL, 's' },
+	{ "fault", required_argument, NULL, 'F' },
+	{ "stats", no_argument, NULL, 'S' },
+	{ "trace", required_argument, NULL, 't' },
+	{ "preset", required_argument, NULL, 'P' },
+	{ "clock-budget", required_argument, NULL, 'T' },
+	{ "budget", required_argument, NULL, 'B' },
+	{ "sample", required_argument, NULL, 'd' },
+	{ "decimate", required_argument, NULL, 'D' },
+	{ "trigger", required_argument, NULL, 'g' },
+	{ "residency", required_argument, NULL, 'u' },
+	{ "expect", required_argument, NULL, 'e' },
+	{ "check", no_argument, NULL, 'k' },
+	{ "export", required_argument, NULL, 'w' },
+	{ "shm", required_argument, NULL, 'M' },
+	{ "interval", required_argument, NULL, 'I' },
+	{ "save", required_argument, NULL, 'o' },
+	{ "diff", required_argument, NULL, 'x' },
+	{ "tolerance", required_argument, NULL, 'z' },
+	{ "important", required_argument, NULL, 'i' },
+	{ "timeline", required_argument, NULL, 'j' },
+	{ "lock", required_argument, NULL, 'L' },
+	{ "lock-timeout", required_argument, NULL, 'W' },
+	{ "reuse", required_argument, NULL, 'A' },
+	{}
+};
+
 int main(int argc, char **argv)
 {
 	const struct debugcc_platform *platform = NULL;
-	const struct measure_clk *clk = NULL;
+	uint64_t start = arch_counter();
+	enum stats_phase prev;
+	struct measure_clk clk;
+	int clk_idx = -1;
 	bool do_list_clocks = false;
 	bool all_clocks = false;
+	bool simulate = false;
+	bool fake_devmem = false;
+	bool dry_run = false;
+	bool stats = false;
 	const char *block_name = NULL;
+	const char *root = NULL;
+	const char *trace_path = NULL;
+	const char *replay_path = NULL;
+	const char *replay_platform;
+	unsigned long budget_us = 0;
+	unsigned long sample_us = 0;
+	unsigned int decimate = 1;
+	bool triggered = false;
+	unsigned long residency_us = 0;
+	struct measure_clk *clks;
+	unsigned int *indexes;
+	unsigned int nclks;
+	const char *export_path = NULL;
+	const char *shm_name = NULL;
+	unsigned long interval_us = 10000000;
+	const char *save_path = NULL;
+	struct snapshot **snapshots = NULL;
+	unsigned int nsnapshots = 0;
+	bool failed = false;
+	const char *expect_path = NULL;
+	bool check = false;
+	bool arbitrate = false;
+	bool lock_given = false;
+	const char *timeline_path = NULL;
+	unsigned int i;
+	unsigned long ref_rate = 0;
+	char *ref_name = NULL;
+	char *rate_str;
 	int devmem;
 	int opt;
 	int ret;
 
-	while ((opt = getopt(argc, argv, "ab:lp:")) != -1) {
+	while ((opt = getopt_long(argc, argv, "ab:c:d:e:f:g:i:j:klmno:p:r:st:u:w:x:z:A:B:D:F:I:L:M:P:R:ST:W:", options, NULL)) != -1) {
 		switch (opt) {
 		case 'a':
 			all_clocks = true;
@@ -311,46 +1225,243 @@ int main(int argc, char **argv)
 		case 'b':
 			block_name = strdup(optarg);
 			break;
+		case 'c':
+			ref_name = strdup(optarg);
+			break;
+		case 'f':
+			platform = platform_load(optarg);
+			if (!platform)
+				exit(1);
+			break;
+		case 'i':
+			if (sweep_important(optarg) < 0)
+				err(1, "failed to parse important clocks");
+			break;
+		case 'j':
+			timeline_path = optarg;
+			break;
 		case 'l':
 			do_list_clocks = true;
 			break;
+		case 'n':
+			dry_run = true;
+			simulate = true;
+			break;
 		case 'p':
 			platform = find_platform(optarg);
 			break;
+		case 'r':
+			root = optarg;
+			break;
+		case 'm':
+			fake_devmem = true;
+			break;
+		case 's':
+			simulate = true;
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
+		case 'd':
+			sample_us = strtod(optarg, NULL) * 1000;
+			break;
+		case 'D':
+			decimate = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			if (trigger_parse(optarg) < 0) {
+				fprintf(stderr, "invalid trigger \"%s\"\n", optarg);
+				exit(1);
+			}
+			triggered = true;
+			break;
+		case 'u':
+			residency_us = strtod(optarg, NULL) * 1000;
+			break;
+		case 'e':
+			expect_path = optarg;
+			break;
+		case 'k':
+			check = true;
+			break;
+		case 'w':
+			export_path = optarg;
+			break;
+		case 'M':
+			shm_name = optarg;
+			break;
+		case 'I':
+			interval_us = strtod(optarg, NULL) * 1000;
+			break;
+		case 'o':
+			save_path = optarg;
+			break;
+		case 'x':
+			snapshots = realloc(snapshots, (nsnapshots + 1) * sizeof(*snapshots));
+			if (!snapshots)
+				err(1, "failed to allocate snapshots");
+
+			snapshots[nsnapshots] = snapshot_load(optarg);
+			if (!snapshots[nsnapshots])
+				exit(1);
+			nsnapshots++;
+			break;
+		case 'z':
+			if (snapshot_tolerance(optarg) < 0) {
+				fprintf(stderr, "invalid tolerance \"%s\"\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'L':
+			arbiter_path(optarg);
+			arbitrate = true;
+			lock_given = true;
+			break;
+		case 'W':
+			arbiter_timeout(strtod(optarg, NULL) * 1000);
+			break;
+		case 'A':
+			arbiter_reuse(strtod(optarg, NULL) * 1000);
+			break;
+		case 'B':
+			budget_us = strtod(optarg, NULL) * 1000;
+			break;
+		case 'R':
+			replay_path = optarg;
+			break;
+		case 'S':
+			stats = true;
+			break;
+		case 'F':
+			if (sim_fault(optarg) < 0) {
+				fprintf(stderr, "invalid fault \"%s\"\n", optarg);
+				exit(1);
+			}
+			simulate = true;
+			break;
+		case 'P':
+			if (measure_config_preset(optarg) < 0) {
+				fprintf(stderr, "no preset named \"%s\"\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'T':
+			measure_config_budget(strtod(optarg, NULL) * 1000);
+			break;
 		default:
 			usage();
 			/* NOTREACHED */
 		}
 	}
 
+	if (replay_path) {
+		replay_platform = replay_init(replay_path);
+		if (!replay_platform)
+			exit(1);
+
+		if (!platform)
+			platform = find_platform(replay_platform);
+		else if (strcmp(platform->name, replay_platform))
+			warnx("replaying trace of %s on %s", replay_platform, platform->name);
+	}
+
+	if (nsnapshots && !platform) {
+		platform = find_platform(snapshot_platform(snapshots[0]));
+		if (!platform)
+			errx(1, "%s: unknown platform %s", argv[0], snapshot_platform(snapshots[0]));
+	}
+
 	if (!platform) {
 		platform = match_platform(argv[0]);
+		if (!platform)
+			platform = detect_platform(root);
 		if (!platform)
 			usage();
 	}
 
+	/* Comparing snapshots needs no hardware */
+	if (nsnapshots > 1) {
+		for (i = 1; i < nsnapshots; i++) {
+			ret = snapshot_diff(platform, snapshots[0], snapshots[i]);
+			if (ret)
+				failed = true;
+		}
+
+		exit(failed ? 1 : 0);
+	}
+
 	if (do_list_clocks) {
 		list_clocks_block(platform, block_name);
 		exit(0);
 	}
 
-	if (!all_clocks) {
+	if (ref_name) {
+		rate_str = strchr(ref_name, '=');
+		if (rate_str) {
+			*rate_str++ = '\0';
+			ref_rate = strtoul(rate_str, NULL, 0);
+		}
+
+		clk_idx = find_clock(platform, ref_name, &clk);
+		if (clk_idx < 0) {
+			fprintf(stderr, "no clock named \"%s\"\n", ref_name);
+			exit(1);
+		}
+	} else if (!all_clocks) {
 		if (optind >= argc)
 			usage();
 
-		clk = find_clock(platform, argv[optind]);
-		if (!clk) {
+		clk_idx = find_clock(platform, argv[optind], &clk);
+		if (clk_idx < 0) {
 			fprintf(stderr, "no clock named \"%s\"\n", argv[optind]);
 			exit(1);
 		}
 	}
 
-	devmem = open("/dev/mem", O_RDWR | O_SYNC);
-	if (devmem < 0)
-		err(1, "failed to open /dev/mem");
+	if (simulate) {
+		devmem = -1;
+		if (sim_init(platform, dry_run) < 0)
+			exit(1);
+	} else if (replay_path) {
+		devmem = -1;
+		if (!ref_name)
+			replay_calibration(platform);
+	} else if (fake_devmem) {
+		devmem = fakemem_init(platform);
+		if (devmem < 0)
+			exit(1);
+	} else {
+		devmem = open("/dev/mem", O_RDWR | O_SYNC);
+		if (devmem < 0)
+			err(1, "failed to open /dev/mem");
+
+		/* The debug muxes are shared with other processes */
+		arbitrate = true;
+
+		if (!ref_name && calibration_load(platform) < 0)
+			exit(1);
+	}
+
+	/* Systems without a usable default lock file measure unarbitrated */
+	if (arbitrate && !dry_run && arbiter_init(platform) < 0) {
+		if (lock_given)
+			exit(1);
+		warnx("not arbitrating the debug muxes with other processes");
+	}
+
+	if (stats && stats_init(devmem, start) < 0)
+		exit(1);
+
+	if (timeline_path && !dry_run && timeline_open(timeline_path) < 0)
+		exit(1);
+
+	if (trace_path && trace_init(trace_path, platform, devmem) < 0)
+		exit(1);
 
 	if (platform->premap) {
+		prev = stats_enter(STATS_PREMAP);
 		ret = platform->premap(devmem);
+		stats_leave(prev);
 		if (ret < 0)
 			exit (1);
 	}
@@ -359,15 +1470,64 @@ int main(int argc, char **argv)
 	if (ret < 0)
 		exit(1);
 
-	if (clk) {
-		measure(clk);
+	if (dry_run) {
+		if (sim_dry_run(platform, clk_idx >= 0 ? &clk : NULL, block_name, budget_us) < 0)
+			exit(1);
+	} else if (ref_name) {
+		if (calibrate(platform, &clk, ref_rate) < 0)
+			exit(1);
+	} else if (export_path || shm_name) {
+		clks = find_clocks(platform, block_name, argv + optind, argc - optind,
+				   &indexes, &nclks);
+		if (export_path)
+			export_textfile(export_path);
+		if (shm_name)
+			export_shm(shm_name);
+		if (export_run(platform, clks, indexes, nclks, interval_us) < 0)
+			exit(1);
+	} else if (clk_idx >= 0 && triggered) {
+		clks = find_clocks(platform, NULL, argv + optind, argc - optind, NULL, &nclks);
+		if (trigger_run(clks, nclks, sample_us) < 0)
+			exit(1);
+	} else if (clk_idx >= 0 && residency_us) {
+		clks = find_clocks(platform, NULL, argv + optind, argc - optind, NULL, &nclks);
+		if (residency_run(clks, nclks, residency_us) < 0)
+			exit(1);
+	} else if (clk_idx >= 0 && sample_us) {
+		if (sample_clock(&clk, sample_us, decimate) < 0)
+			exit(1);
+	} else if (clk_idx >= 0) {
+		measure(&clk);
 	} else {
-		for (clk = platform->clocks; clk->name; clk++) {
-			if (clock_from_block(clk, block_name)) {
-				measure(clk);
-			}
-		}
+		if ((save_path || nsnapshots) && snapshot_begin(platform) < 0)
+			exit(1);
+
+		if (expect_load(platform, expect_path) < 0)
+			exit(1);
+
+		if (check && expect_check_mode() < 0)
+			errx(1, "no expected rates for %s", platform->name);
+
+		if (sweep(platform, block_name, budget_us, nsnapshots) < 0)
+			exit(1);
+
+		if (save_path && snapshot_save(save_path) < 0)
+			exit(1);
+
+		if (nsnapshots && snapshot_diff(platform, snapshots[0], NULL))
+			failed = true;
+
+		if (expect_report() && check)
+			failed = true;
 	}
 
-	return 0;
+	stats_report();
+
+	if (simulate && sim_report())
+		exit(1);
+
+	if (replay_path && replay_report())
+		exit(1);
+
+	return failed ? 1 : 0;
 }
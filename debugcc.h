@@ -4,6 +4,11 @@
 #ifndef __DEBUGCC_H__
 #define __DEBUGCC_H__
 
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
 #define BIT(x) (1 << (x))
 #define GENMASK(h, l) (((~0UL) << (l)) & (~0UL >> (sizeof(long) * 8 - 1 - (h))))
 
@@ -49,39 +54,376 @@ struct gcc_mux {
 
 	unsigned int debug_ctl_reg;
 	unsigned int debug_status_reg;
+
+	/* Counter latency corrections in 1/1000 counts and ticks, see calibrate.c */
+	bool calibrated;
+	int count_offset;
+	int tick_offset;
+
+	/* Total count of the last measurement, or why the counter failed it */
+	uint64_t count;
+	int error;
+};
+
+/* The ctl register takes up to 20 bits of ticks, the status has 25 bits of count */
+#define GCC_SHORT_TICKS		0x1000
+#define GCC_LONG_TICKS		0x10000
+#define GCC_MAX_TICKS		0xfffff
+#define GCC_MAX_COUNT		0x1ffffff
+
+/* Keep the expected count of a window well clear of wrapping */
+#define GCC_COUNT_LIMIT		(GCC_MAX_COUNT / 2)
+
+#define GCC_COUNT_OFFSET	1500
+#define GCC_TICK_OFFSET		3500
+
+/* Slack on top of twice the window before the counter is considered stuck */
+#define GCC_TIMEOUT_US		10000
+
+/* Least slack on top of the window when a time budget is running out */
+#define GCC_DEADLINE_SLACK_US	1000
+
+/*
+ * Trade-off between measurement time and accuracy, selected through one of
+ * the named presets and optionally limited by a time budget per clock.
+ */
+struct measure_config {
+	const char *name;
+
+	/* Window used to find the rate range of the clock */
+	unsigned int short_ticks;
+
+	/* Nominal measurement window and the number of windows summed */
+	unsigned int long_ticks;
+	unsigned int samples;
+
+	/* Count to aim for on slow clocks, by extending or chaining windows */
+	unsigned int min_count;
+
+	/* Upper bound of the summed windows, in ticks and time */
+	uint64_t max_ticks;
+	unsigned long budget_us;
+};
+
+extern struct measure_config measure_config;
+
+const struct measure_config *measure_preset(const char *name);
+int measure_config_preset(const char *name);
+void measure_config_budget(unsigned long budget_us);
+unsigned int measure_sample_ticks(const struct measure_clk *clk, unsigned long rate,
+				  unsigned long *resolution);
+unsigned long measure_config_cost(const struct measure_config *cfg,
+				  const struct gcc_mux *gcc);
+
+/* Measured with less than the configured precision, or not at all */
+#define MEASURE_REDUCED		BIT(0)
+#define MEASURE_SKIPPED		BIT(1)
+
+/* Violating the expected rates of the clock, see expect.c */
+#define MEASURE_UNEXPECTED	BIT(2)
+#define MEASURE_REQUIRED	BIT(3)
+
+struct measurement {
+	unsigned long rate;
+	unsigned long resolution;
+	unsigned int flags;
+	int error;
 };
 
 struct measure_clk {
-	char *name;
+	const char *name;
 	struct debug_mux *clk_mux;
 	unsigned long mux;
 
 	unsigned int fixed_div;
 };
 
+/*
+ * Packed form of the measure_clk tables in platforms/, generated at build
+ * time by gen-platform.py.
+ */
+struct clock_entry {
+	uint32_t name;
+	uint16_t mux;
+	uint8_t clk_mux;
+	uint8_t fixed_div;
+};
+
+struct clock_table {
+	const char *names;
+	struct debug_mux *const *muxes;
+	unsigned int nmuxes;
+	const struct clock_entry *entries;
+	unsigned int count;
+};
+
 struct debugcc_platform {
 	const char *name;
-	const struct measure_clk *clocks;
+	const struct clock_table *clocks;
 	int (*premap)(int devmem);
 };
 
+static inline unsigned int platform_nclocks(const struct debugcc_platform *platform)
+{
+	return platform->clocks->count;
+}
+
+/* Unpack entry @idx of the clock table of @platform into @clk */
+static inline void platform_clock(const struct debugcc_platform *platform,
+				  unsigned int idx, struct measure_clk *clk)
+{
+	const struct clock_table *table = platform->clocks;
+	const struct clock_entry *entry = &table->entries[idx];
+
+	clk->name = table->names + entry->name;
+	clk->clk_mux = table->muxes[entry->clk_mux];
+	clk->mux = entry->mux;
+	clk->fixed_div = entry->fixed_div;
+}
+
 #define container_of(ptr, type, member) \
 	((type *) ((char *)(ptr) - offsetof(type, member)))
 
-static inline uint32_t readl(void *ptr)
+/*
+ * MMIO barriers. Accesses to the same clock controller are ordered by the
+ * architecture, so only ordering between different blocks (e.g. a leaf mux
+ * and the GCC counter) or completion of a write needs to be enforced.
+ */
+#if defined(__aarch64__)
+#define __mmio_rmb()	__asm__ __volatile__("dmb oshld" : : : "memory")
+#define __mmio_wmb()	__asm__ __volatile__("dmb oshst" : : : "memory")
+#define __mmio_mb()	__asm__ __volatile__("dsb sy" : : : "memory")
+#elif defined(__arm__)
+#define __mmio_rmb()	__asm__ __volatile__("dmb osh" : : : "memory")
+#define __mmio_wmb()	__asm__ __volatile__("dmb oshst" : : : "memory")
+#define __mmio_mb()	__asm__ __volatile__("dsb sy" : : : "memory")
+#else
+#define __mmio_rmb()	__asm__ __volatile__("" : : : "memory")
+#define __mmio_wmb()	__asm__ __volatile__("" : : : "memory")
+#define __mmio_mb()	__asm__ __volatile__("" : : : "memory")
+#endif
+
+enum mmio_barrier {
+	MMIO_RMB,
+	MMIO_WMB,
+	MMIO_MB,
+};
+
+/*
+ * Alternative register backend, used to run debugcc against a simulated
+ * SoC. When NULL, accesses go straight to the memory mapped hardware.
+ */
+struct mmio_ops {
+	void *(*map)(struct debug_mux *mux);
+	uint32_t (*read)(void *ptr);
+	void (*write)(uint32_t val, void *ptr);
+	void (*barrier)(enum mmio_barrier type);
+};
+
+extern const struct mmio_ops *mmio_ops;
+
+const struct mmio_ops *mmio_next(int devmem);
+
+static inline void mmio_rmb(void)
+{
+	if (mmio_ops)
+		mmio_ops->barrier(MMIO_RMB);
+	else
+		__mmio_rmb();
+}
+
+static inline void mmio_wmb(void)
+{
+	if (mmio_ops)
+		mmio_ops->barrier(MMIO_WMB);
+	else
+		__mmio_wmb();
+}
+
+/* Wait for completion of all outstanding accesses */
+static inline void mmio_mb(void)
+{
+	if (mmio_ops)
+		mmio_ops->barrier(MMIO_MB);
+	else
+		__mmio_mb();
+}
+
+/* Relaxed accessors, only ordered against accesses to the same block */
+static inline uint32_t readl_relaxed(void *ptr)
 {
+	if (mmio_ops)
+		return mmio_ops->read(ptr);
+
 	return *((volatile uint32_t*)ptr);
 }
 
+static inline void writel_relaxed(uint32_t val, void *ptr)
+{
+	if (mmio_ops)
+		mmio_ops->write(val, ptr);
+	else
+		*((volatile uint32_t*)ptr) = val;
+}
+
+/* Ordered accessors, ordered against all preceding and following accesses */
+static inline uint32_t readl(void *ptr)
+{
+	uint32_t val = readl_relaxed(ptr);
+
+	mmio_rmb();
+
+	return val;
+}
+
 static inline void writel(uint32_t val, void *ptr)
 {
-	*((volatile uint32_t*)ptr) = val;
+	mmio_wmb();
+	writel_relaxed(val, ptr);
 }
 
+/*
+ * Trace of register accesses, as written by trace.c. Timestamps are in ticks
+ * of arch_counter() and barriers record their enum mmio_barrier as value.
+ * Consecutive identical reads, such as those polling a status register, are
+ * recorded once along with the number of repetitions. The calibration of the
+ * GCC debug counter in use is recorded as well, with an xo_rate of 0 if the
+ * counter wasn't calibrated.
+ */
+#define TRACE_MAGIC	"DCCTRACE"
+#define TRACE_VERSION	1
+
+enum trace_type {
+	TRACE_READ,
+	TRACE_WRITE,
+	TRACE_BARRIER,
+};
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t xo_rate;
+	uint64_t counter_freq;
+	uint64_t count;
+	uint64_t dropped;
+	char platform[32];
+	int32_t count_offset;
+	int32_t tick_offset;
+};
+
+struct trace_record {
+	uint64_t timestamp;
+	uint64_t phys;
+	uint32_t val;
+	uint32_t type;
+	uint64_t repeat;
+};
+
+/*
+ * Free running reference timer, the ARM generic timer where available and
+ * CLOCK_MONOTONIC_RAW otherwise.
+ */
+#if defined(__aarch64__)
+static inline uint64_t arch_counter(void)
+{
+	uint64_t val;
+
+	__asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r" (val) : : "memory");
+
+	return val;
+}
+
+static inline uint64_t arch_counter_freq(void)
+{
+	uint64_t val;
+
+	__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (val));
+
+	return val;
+}
+#else
+static inline uint64_t arch_counter(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t arch_counter_freq(void)
+{
+	return 1000000000ULL;
+}
+#endif
+
+void measure_clock(const struct measure_clk *clk, struct measurement *m);
+void print_measurement(const struct measure_clk *clk, const struct measurement *m);
+bool clock_from_block(const struct measure_clk *clk, const char *block_name);
+
+int sweep_important(const char *names);
+int sweep(const struct debugcc_platform *platform, const char *block_name,
+	  unsigned long budget_us, bool no_print);
+
+int sample_clock(const struct measure_clk *clk, unsigned long duration_us,
+		 unsigned int decimate);
+
+int trigger_parse(const char *spec);
+int trigger_run(const struct measure_clk *clks, unsigned int nclks,
+		unsigned long timeout_us);
+
+int timeline_open(const char *path);
+void timeline_sample(const struct measure_clk *clk, const struct measurement *m,
+		     uint64_t timestamp);
+
+int residency_run(const struct measure_clk *clks, unsigned int nclks,
+		  unsigned long duration_us);
+
+int expect_load(const struct debugcc_platform *platform, const char *path);
+int expect_check_mode(void);
+bool expect_classify(unsigned int idx, struct measurement *m);
+unsigned int expect_report(void);
+
+void export_textfile(const char *path);
+void export_shm(const char *name);
+int export_run(const struct debugcc_platform *platform, const struct measure_clk *clks,
+	       const unsigned int *indexes, unsigned int nclks, unsigned long interval_us);
+
+struct snapshot;
+
+int snapshot_tolerance(const char *spec);
+int snapshot_begin(const struct debugcc_platform *platform);
+void snapshot_add(unsigned int idx, const struct measurement *m);
+int snapshot_save(const char *path);
+struct snapshot *snapshot_load(const char *path);
+const char *snapshot_platform(const struct snapshot *snap);
+int snapshot_diff(const struct debugcc_platform *platform,
+		  const struct snapshot *old, const struct snapshot *new);
+
+void arbiter_path(const char *path);
+void arbiter_timeout(unsigned long timeout_us);
+void arbiter_reuse(unsigned long age_us);
+int arbiter_init(const struct debugcc_platform *platform);
+int arbiter_acquire(unsigned long timeout_us);
+void arbiter_release(void);
+bool arbiter_lookup(const struct measure_clk *clk, struct measurement *m);
+void arbiter_store(const struct measure_clk *clk, const struct measurement *m);
+
 int mmap_mux(int devmem, struct debug_mux *mux);
+void shadow_invalidate(void);
+void mux_prepare_enable(struct debug_mux *mux, int selector);
 void mux_enable(struct debug_mux *mux);
 void mux_disable(struct debug_mux *mux);
 
+struct gcc_mux *platform_gcc(const struct debugcc_platform *platform);
+int find_clock(const struct debugcc_platform *platform, const char *name,
+	       struct measure_clk *clk);
+uint32_t gcc_counter_enable(struct gcc_mux *gcc);
+void gcc_counter_disable(struct gcc_mux *gcc, uint32_t xo_div4);
+int measure_ticks(struct gcc_mux *gcc, unsigned int ticks);
+uint64_t gcc_count_to_rate(const struct gcc_mux *gcc, uint64_t count,
+			   unsigned int ticks, unsigned int windows);
+
 unsigned long measure_gcc(const struct measure_clk *clk,
 			  const struct debug_mux *mux);
 unsigned long measure_leaf(const struct measure_clk *clk,
@@ -91,4 +433,107 @@ unsigned long measure_mccc(const struct measure_clk *clk,
 
 extern const struct debugcc_platform *platforms[];
 
+int calibration_load(const struct debugcc_platform *platform);
+int calibrate(const struct debugcc_platform *platform,
+	      const struct measure_clk *ref, unsigned long ref_rate);
+
+const struct debugcc_platform *platform_load(const char *path);
+const struct debugcc_platform *detect_platform(const char *root);
+
+/* Phases of a run, as accounted by stats.c */
+enum stats_phase {
+	STATS_MAIN,
+	STATS_PREMAP,
+	STATS_MMAP,
+	STATS_MUX_ENABLE,
+	STATS_MEASURE,
+	STATS_MEASURE_TICKS,
+	STATS_MUX_DISABLE,
+	STATS_OUTPUT,
+	STATS_NR_PHASES,
+};
+
+/*
+ * Diagnostics of debugcc itself, left out of builds with the "diagnostics"
+ * meson option disabled, where they fail to initialize
+ */
+#ifdef DEBUGCC_DIAGNOSTICS
+int stats_init(int devmem, uint64_t start);
+enum stats_phase stats_enter(enum stats_phase phase);
+void stats_leave(enum stats_phase prev);
+void stats_clock_begin(void);
+void stats_clock_end(const struct measure_clk *clk);
+void stats_report(void);
+
+int trace_init(const char *path, const struct debugcc_platform *platform, int devmem);
+
+const char *replay_init(const char *path);
+void replay_calibration(const struct debugcc_platform *platform);
+int replay_report(void);
+
+int sim_fault(const char *spec);
+int sim_init(const struct debugcc_platform *platform, bool dry_run);
+void sim_clock_begin(const struct measure_clk *clk);
+void sim_clock_end(void);
+uint64_t sim_elapsed_us(void);
+int sim_dry_run(const struct debugcc_platform *platform,
+		const struct measure_clk *clk, const char *block_name,
+		unsigned long budget_us);
+int sim_report(void);
+
+int fakemem_init(const struct debugcc_platform *platform);
+#else
+static inline int diagnostics_missing(void)
+{
+	warnx("built without diagnostics");
+	return -1;
+}
+
+static inline int stats_init(int devmem, uint64_t start) { return diagnostics_missing(); }
+static inline enum stats_phase stats_enter(enum stats_phase phase) { return STATS_MAIN; }
+static inline void stats_leave(enum stats_phase prev) {}
+static inline void stats_clock_begin(void) {}
+static inline void stats_clock_end(const struct measure_clk *clk) {}
+static inline void stats_report(void) {}
+
+static inline int trace_init(const char *path, const struct debugcc_platform *platform,
+			     int devmem)
+{
+	return diagnostics_missing();
+}
+
+static inline const char *replay_init(const char *path)
+{
+	diagnostics_missing();
+	return NULL;
+}
+
+static inline void replay_calibration(const struct debugcc_platform *platform) {}
+static inline int replay_report(void) { return 0; }
+
+static inline int sim_fault(const char *spec) { return diagnostics_missing(); }
+static inline int sim_init(const struct debugcc_platform *platform, bool dry_run)
+{
+	return diagnostics_missing();
+}
+
+static inline void sim_clock_begin(const struct measure_clk *clk) {}
+static inline void sim_clock_end(void) {}
+static inline uint64_t sim_elapsed_us(void) { return 0; }
+
+static inline int sim_dry_run(const struct debugcc_platform *platform,
+			      const struct measure_clk *clk, const char *block_name,
+			      unsigned long budget_us)
+{
+	return diagnostics_missing();
+}
+
+static inline int sim_report(void) { return 0; }
+
+static inline int fakemem_init(const struct debugcc_platform *platform)
+{
+	return diagnostics_missing();
+}
+#endif
+
 #endif
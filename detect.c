@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Detection of the platform debugcc is running on
+ *
+ * The SoC is identified by the soc_id or machine attributes exposed by the
+ * Qualcomm socinfo driver in /sys/devices/soc0, falling back to the
+ * compatibles of the device tree root node. Both are matched against a fixed
+ * table, as the various package and automotive variants of a SoC share its
+ * clock tables.
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <debugcc.h>
+
+struct soc_match {
+	unsigned int soc_id;
+	const char *machine;
+	const char *compatible;
+	const char *platform;
+};
+
+/* soc_id and machine as reported by drivers/soc/qcom/socinfo.c */
+static const struct soc_match soc_matches[] = {
+	{ 126, "MSM8974", "qcom,msm8974", "msm8974" },
+	{ 202, "IPQ8064", "qcom,ipq8064", "ipq8064" },
+	{ 207, "MSM8994", "qcom,msm8994", "msm8994" },
+	{ 233, "MSM8936", "qcom,msm8936", "msm8936" },
+	{ 239, "MSM8939", "qcom,msm8939", "msm8936" },
+	{ 246, "MSM8996", "qcom,msm8996", "msm8996" },
+	{ 291, "APQ8096", "qcom,apq8096", "msm8996" },
+	{ 292, "MSM8998", "qcom,msm8998", "msm8998" },
+	{ 305, "MSM8996SG", NULL, "msm8996" },
+	{ 319, "APQ8098", "qcom,apq8098", "msm8998" },
+	{ 321, "SDM845", "qcom,sdm845", "sdm845" },
+	{ 339, "SM8150", "qcom,sm8150", "sm8150" },
+	{ 341, "SDA845", "qcom,sda845", "sdm845" },
+	{ 356, "SM8250", "qcom,sm8250", "sm8250" },
+	{ 362, "SA8155", "qcom,sa8155p", "sm8150" },
+	{ 394, "SM6125", "qcom,sm6125", "sm6125" },
+	{ 410, "QCS404", "qcom,qcs404", "qcs404" },
+	{ 417, "SM6115", "qcom,sm6115", "sm6115" },
+	{ 418, "SM4250", "qcom,sm4250", "sm6115" },
+	{ 425, "SC7180", "qcom,sc7180", "sc7180" },
+	{ 434, "SM6350", "qcom,sm6350", "sm6350" },
+	{ 439, "SM8350", "qcom,sm8350", "sm8350" },
+	{ 441, "QCM2290", "qcom,qcm2290", "qcm2290" },
+	{ 449, "SC8280XP", "qcom,sc8280xp", "sc8280xp" },
+	{ 457, "SM8450", "qcom,sm8450", "sm8450" },
+	{ 507, "SM6375", "qcom,sm6375", "sm6375" },
+	{ 519, "SM8550", "qcom,sm8550", "sm8550" },
+	{ 555, "X1E80100", "qcom,x1e80100", "hamoa" },
+	{ 557, "SM8650", "qcom,sm8650", "sm8650" },
+	{ 0, NULL, "qcom,milos", "milos" },
+	{ 0, NULL, "qcom,glymur", "glymur" },
+};
+
+#define NUM_SOC_MATCHES (sizeof(soc_matches) / sizeof(soc_matches[0]))
+
+/* Read a small sysfs or procfs file below @root, returns the length read */
+static ssize_t detect_read(const char *root, const char *file, char *buf, size_t size)
+{
+	char path[256];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s%s", root, file);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+
+	buf[len] = '\0';
+
+	return len;
+}
+
+static const struct soc_match *detect_soc0(const char *root)
+{
+	unsigned int soc_id;
+	char buf[64];
+	unsigned int i;
+
+	if (detect_read(root, "/sys/devices/soc0/soc_id", buf, sizeof(buf)) > 0) {
+		soc_id = strtoul(buf, NULL, 10);
+
+		for (i = 0; i < NUM_SOC_MATCHES; i++) {
+			if (soc_matches[i].soc_id && soc_matches[i].soc_id == soc_id)
+				return &soc_matches[i];
+		}
+	}
+
+	if (detect_read(root, "/sys/devices/soc0/machine", buf, sizeof(buf)) > 0) {
+		buf[strcspn(buf, "\n")] = '\0';
+
+		for (i = 0; i < NUM_SOC_MATCHES; i++) {
+			if (soc_matches[i].machine && !strcmp(soc_matches[i].machine, buf))
+				return &soc_matches[i];
+		}
+	}
+
+	return NULL;
+}
+
+static const struct soc_match *detect_compatible(const char *root)
+{
+	const char *compat;
+	char buf[512];
+	ssize_t len;
+	unsigned int i;
+
+	len = detect_read(root, "/proc/device-tree/compatible", buf, sizeof(buf));
+	if (len <= 0)
+		return NULL;
+
+	/* The most specific compatible comes first, the SoC last */
+	for (compat = buf; compat < buf + len; compat += strlen(compat) + 1) {
+		for (i = 0; i < NUM_SOC_MATCHES; i++) {
+			if (soc_matches[i].compatible && !strcmp(soc_matches[i].compatible, compat))
+				return &soc_matches[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * detect_platform() - detect the platform from the running system
+ * @root: directory to look for sysfs and procfs in, or NULL for "/"
+ *
+ * Return: the detected debugcc_platform, or NULL if the SoC isn't recognized
+ * or support for it isn't built in
+ */
+const struct debugcc_platform *detect_platform(const char *root)
+{
+	const struct debugcc_platform **p;
+	const struct soc_match *match;
+
+	if (!root)
+		root = "";
+
+	match = detect_soc0(root);
+	if (!match)
+		match = detect_compatible(root);
+	if (!match)
+		return NULL;
+
+	for (p = platforms; *p; p++) {
+		if (!strcmp((*p)->name, match->platform))
+			return *p;
+	}
+
+	warnx("detected %s, but support for it is not built in", match->platform);
+
+	return NULL;
+}
@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Expected clock rates
+ *
+ * The rates clocks are expected to run at are described per platform in
+ * EXPECT_DIR/<platform>.expect, or a file given on the command line, one
+ * clock per line:
+ *
+ *   # comment
+ *   <clk> <item>[,<item>...]
+ *
+ * where each item is a rate in Hz, such as an OPP of the clock, a range of
+ * rates "<min>-<max>", or "off" if the clock may be gated. A clock described
+ * as "off" alone must be off, any other clock is required to run.
+ *
+ * The sweep classifies each described clock as ok, unexpected, when faulted
+ * or running at a rate not described, or off but required. Rates match
+ * within EXPECT_TOLERANCE_PPM plus the resolution of the measurement.
+ * Clocks not described aren't classified.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <debugcc.h>
+
+#ifndef EXPECT_DIR
+#define EXPECT_DIR "/etc/debugcc"
+#endif
+
+#define EXPECT_TOLERANCE_PPM	1000
+
+struct expect_range {
+	unsigned long min;
+	unsigned long max;
+};
+
+struct expect {
+	bool may_be_off;
+	unsigned int nranges;
+	struct expect_range ranges[];
+};
+
+static struct {
+	struct expect **clocks;
+	unsigned int nclocks;
+	bool check;
+
+	unsigned int ok;
+	unsigned int unexpected;
+	unsigned int required;
+} expect;
+
+static int expect_find(const struct debugcc_platform *platform, const char *name)
+{
+	struct measure_clk clk;
+	unsigned int i;
+
+	for (i = 0; i < platform_nclocks(platform); i++) {
+		platform_clock(platform, i, &clk);
+
+		if (!strcmp(clk.name, name))
+			return i;
+	}
+
+	return -1;
+}
+
+static struct expect *expect_parse(char *items)
+{
+	struct expect *e;
+	unsigned int n = 1;
+	struct expect_range *range;
+	char *item;
+	char *end;
+	char *p;
+
+	for (p = items; *p; p++) {
+		if (*p == ',')
+			n++;
+	}
+
+	e = calloc(1, sizeof(*e) + n * sizeof(*e->ranges));
+	if (!e)
+		return NULL;
+
+	for (item = strtok(items, ","); item; item = strtok(NULL, ",")) {
+		if (!strcmp(item, "off")) {
+			e->may_be_off = true;
+			continue;
+		}
+
+		range = &e->ranges[e->nranges];
+		range->min = strtoul(item, &end, 0);
+		if (end == item)
+			goto invalid;
+
+		if (*end == '-') {
+			item = end + 1;
+			range->max = strtoul(item, &end, 0);
+			if (end == item || range->max < range->min)
+				goto invalid;
+		} else {
+			range->max = range->min;
+		}
+
+		if (*end)
+			goto invalid;
+
+		e->nranges++;
+	}
+
+	return e;
+
+invalid:
+	free(e);
+
+	return NULL;
+}
+
+/**
+ * expect_load() - load the expected rates of a platform
+ * @platform: platform the rates are described for
+ * @path: file describing the rates, or NULL for the platform's default
+ *
+ * Return: 0 on success or if there's no default file for the platform, -1 on
+ * failure
+ */
+int expect_load(const struct debugcc_platform *platform, const char *path)
+{
+	unsigned int lineno = 0;
+	char default_path[256];
+	char line[512];
+	char *items;
+	char *name;
+	int idx;
+	FILE *fp;
+
+	if (!path) {
+		snprintf(default_path, sizeof(default_path), "%s/%s.expect",
+			 EXPECT_DIR, platform->name);
+		path = default_path;
+	}
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		if (path == default_path && errno == ENOENT)
+			return 0;
+
+		warn("failed to open %s", path);
+		return -1;
+	}
+
+	expect.nclocks = platform_nclocks(platform);
+	expect.clocks = calloc(expect.nclocks, sizeof(*expect.clocks));
+	if (!expect.clocks) {
+		fclose(fp);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+
+		line[strcspn(line, "#\n")] = '\0';
+
+		name = strtok(line, " \t");
+		if (!name)
+			continue;
+
+		items = strtok(NULL, " \t");
+		if (!items || strtok(NULL, " \t")) {
+			warnx("%s:%u: expected \"<clk> <rates>\"", path, lineno);
+			goto err;
+		}
+
+		idx = expect_find(platform, name);
+		if (idx < 0) {
+			warnx("%s:%u: no clock named \"%s\"", path, lineno, name);
+			goto err;
+		}
+
+		free(expect.clocks[idx]);
+		expect.clocks[idx] = expect_parse(items);
+		if (!expect.clocks[idx]) {
+			warnx("%s:%u: invalid rates \"%s\"", path, lineno, items);
+			goto err;
+		}
+	}
+
+	fclose(fp);
+
+	return 0;
+
+err:
+	fclose(fp);
+
+	return -1;
+}
+
+/**
+ * expect_check_mode() - stop the sweep at the first clock violating its
+ * expected rates
+ *
+ * Return: 0 on success, -1 if no expected rates have been loaded
+ */
+int expect_check_mode(void)
+{
+	if (!expect.clocks)
+		return -1;
+
+	expect.check = true;
+
+	return 0;
+}
+
+/**
+ * expect_classify() - classify a measurement against the expected rates
+ * @idx: index of the clock in the platform's clock table
+ * @m: measurement of the clock, flagged MEASURE_UNEXPECTED or
+ *     MEASURE_REQUIRED on violations
+ *
+ * Return: true if the sweep should stop
+ */
+bool expect_classify(unsigned int idx, struct measurement *m)
+{
+	const struct expect *e;
+	unsigned long slack;
+	unsigned int i;
+
+	if (!expect.clocks || idx >= expect.nclocks || !expect.clocks[idx] ||
+	    m->flags & MEASURE_SKIPPED)
+		return false;
+
+	e = expect.clocks[idx];
+
+	if (m->error) {
+		m->flags |= MEASURE_UNEXPECTED;
+	} else if (!m->rate) {
+		if (!e->may_be_off)
+			m->flags |= MEASURE_REQUIRED;
+	} else {
+		slack = m->resolution + m->rate / (1000000 / EXPECT_TOLERANCE_PPM);
+
+		for (i = 0; i < e->nranges; i++) {
+			if (m->rate + slack >= e->ranges[i].min &&
+			    m->rate <= e->ranges[i].max + slack)
+				break;
+		}
+
+		if (i == e->nranges)
+			m->flags |= MEASURE_UNEXPECTED;
+	}
+
+	if (m->flags & MEASURE_UNEXPECTED)
+		expect.unexpected++;
+	else if (m->flags & MEASURE_REQUIRED)
+		expect.required++;
+	else
+		expect.ok++;
+
+	return expect.check && (m->flags & (MEASURE_UNEXPECTED | MEASURE_REQUIRED));
+}
+
+/**
+ * expect_report() - print the totals of the classification
+ *
+ * Return: number of clocks violating their expected rates
+ */
+unsigned int expect_report(void)
+{
+	if (!expect.clocks)
+		return 0;
+
+	fflush(stdout);
+	fprintf(stderr, "expect: %u ok, %u unexpected, %u off but required\n",
+		expect.ok, expect.unexpected, expect.required);
+
+	return expect.unexpected + expect.required;
+}
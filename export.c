@@ -0,0 +1,363 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Metrics exporter
+ *
+ * A set of clocks is measured periodically and the results are published as
+ * a Prometheus textfile, for the textfile collector of the node exporter,
+ * and optionally into a shared memory region, see debugcc-shm.h.
+ *
+ * The textfile is written by a separate thread, to a temporary file which is
+ * renamed over the previous one, so scrapers never see a partial file and a
+ * slow filesystem can't hold up the measurements; a round completing while
+ * the previous one is still being written replaces it. Shared memory entries
+ * are indexed by clock ID and updated under their own sequence count as soon
+ * as each clock has been measured, for lock-free readers using the library
+ * in debugcc-shm.c; a lock on the object keeps a second writer away.
+ *
+ * Every value carries the time it was measured at, the textfile also the age
+ * of the value when it was written.
+ */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <debugcc.h>
+#include <debugcc-shm.h>
+
+struct export_value {
+	const struct measure_clk *clk;
+	struct measurement m;
+	/* CLOCK_REALTIME and CLOCK_MONOTONIC time of the measurement, in ns */
+	uint64_t realtime;
+	uint64_t monotonic;
+};
+
+static struct {
+	const char *textfile;
+	const char *shm_name;
+
+	struct debugcc_shm_header *shm;
+	struct debugcc_shm_entry *entries;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct export_value *pending;
+	bool has_pending;
+	unsigned int nvalues;
+} export = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t export_now(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * export_textfile() - publish measurements as a Prometheus textfile
+ * @path: file to write
+ */
+void export_textfile(const char *path)
+{
+	export.textfile = path;
+}
+
+/**
+ * export_shm() - publish measurements into shared memory
+ * @name: name of the POSIX shared memory object
+ */
+void export_shm(const char *name)
+{
+	export.shm_name = name;
+}
+
+static int export_shm_open(const struct debugcc_platform *platform)
+{
+	unsigned int count = platform_nclocks(platform);
+	struct measure_clk clk;
+	size_t names_size = 0;
+	size_t offset;
+	size_t size;
+	unsigned int i;
+	char *names;
+	void *base;
+	int fd;
+
+	for (i = 0; i < count; i++) {
+		platform_clock(platform, i, &clk);
+		names_size += strlen(clk.name) + 1;
+	}
+
+	offset = sizeof(*export.shm) + count * sizeof(*export.entries);
+	size = offset + names_size;
+
+	fd = shm_open(export.shm_name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		warn("failed to open shared memory %s", export.shm_name);
+		return -1;
+	}
+
+	/* Entries have a single writer, the lock is held until exit */
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+		warnx("another debugcc publishes to %s", export.shm_name);
+		close(fd);
+		return -1;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		warn("failed to size shared memory %s", export.shm_name);
+		close(fd);
+		return -1;
+	}
+
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		warn("failed to map shared memory %s", export.shm_name);
+		close(fd);
+		return -1;
+	}
+
+	memset(base, 0, size);
+
+	export.shm = base;
+	export.entries = base + sizeof(*export.shm);
+
+	export.shm->version = DEBUGCC_SHM_VERSION;
+	export.shm->count = count;
+	export.shm->names_offset = offset;
+	export.shm->names_size = names_size;
+	strncpy(export.shm->platform, platform->name, sizeof(export.shm->platform) - 1);
+
+	names = base + offset;
+	for (i = 0; i < count; i++) {
+		platform_clock(platform, i, &clk);
+		names = stpcpy(names, clk.name) + 1;
+	}
+
+	/* Readers check the magic last */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(export.shm->magic, DEBUGCC_SHM_MAGIC, sizeof(DEBUGCC_SHM_MAGIC));
+
+	return 0;
+}
+
+static void export_shm_update(unsigned int idx, const struct export_value *v)
+{
+	struct debugcc_shm_entry *entry = &export.entries[idx];
+	uint32_t seq = entry->seq;
+
+	__atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&entry->rate, v->m.rate, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->timestamp, v->monotonic, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->error, v->m.error, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->flags, DEBUGCC_SHM_VALID, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static const char *export_block(const struct measure_clk *clk)
+{
+	if (clk->clk_mux && clk->clk_mux->block_name)
+		return clk->clk_mux->block_name;
+
+	return "gcc";
+}
+
+static void export_metric(FILE *fp, const char *name, const char *help,
+			  const struct export_value *values, unsigned int count,
+			  double (*value)(const struct export_value *v, uint64_t now),
+			  uint64_t now)
+{
+	unsigned int i;
+
+	fprintf(fp, "# HELP debugcc_clock_%s %s\n", name, help);
+	fprintf(fp, "# TYPE debugcc_clock_%s gauge\n", name);
+
+	for (i = 0; i < count; i++) {
+		fprintf(fp, "debugcc_clock_%s{clock=\"%s\",block=\"%s\"} %.15g\n", name,
+			values[i].clk->name, export_block(values[i].clk),
+			value(&values[i], now));
+	}
+}
+
+static double export_rate(const struct export_value *v, uint64_t now)
+{
+	return v->m.error ? 0 : v->m.rate;
+}
+
+static double export_fault(const struct export_value *v, uint64_t now)
+{
+	return v->m.error != 0;
+}
+
+static double export_timestamp(const struct export_value *v, uint64_t now)
+{
+	return v->realtime / 1e9;
+}
+
+static double export_age(const struct export_value *v, uint64_t now)
+{
+	return (now - v->realtime) / 1e9;
+}
+
+static int export_write(const struct export_value *values, unsigned int count)
+{
+	uint64_t now = export_now(CLOCK_REALTIME);
+	char tmp[PATH_MAX];
+	FILE *fp;
+	int ret;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", export.textfile);
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		warn("failed to open %s", tmp);
+		return -1;
+	}
+
+	export_metric(fp, "rate_hz", "Measured rate of the clock, 0 when off",
+		      values, count, export_rate, now);
+	export_metric(fp, "fault", "1 if the clock couldn't be measured",
+		      values, count, export_fault, now);
+	export_metric(fp, "timestamp_seconds", "Time the clock was measured at",
+		      values, count, export_timestamp, now);
+	export_metric(fp, "age_seconds", "Age of the measurement when published",
+		      values, count, export_age, now);
+
+	ret = ferror(fp) ? -1 : 0;
+	if (fclose(fp) || ret < 0 || rename(tmp, export.textfile) < 0) {
+		warn("failed to write %s", export.textfile);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *export_publisher(void *arg)
+{
+	struct export_value *values;
+
+	values = calloc(export.nvalues, sizeof(*values));
+	if (!values)
+		err(1, "failed to allocate export buffer");
+
+	for (;;) {
+		pthread_mutex_lock(&export.lock);
+		while (!export.has_pending)
+			pthread_cond_wait(&export.cond, &export.lock);
+		memcpy(values, export.pending, export.nvalues * sizeof(*values));
+		export.has_pending = false;
+		pthread_mutex_unlock(&export.lock);
+
+		export_write(values, export.nvalues);
+	}
+
+	return NULL;
+}
+
+/**
+ * export_run() - measure clocks periodically and publish the results
+ * @platform: platform to measure
+ * @clks: clocks to measure
+ * @indexes: indexes of @clks in the platform's clock table
+ * @nclks: number of clocks in @clks
+ * @interval_us: period of the measurements
+ *
+ * Return: -1 on failure, doesn't return otherwise
+ */
+int export_run(const struct debugcc_platform *platform, const struct measure_clk *clks,
+	       const unsigned int *indexes, unsigned int nclks, unsigned long interval_us)
+{
+	struct export_value *values;
+	struct timespec next;
+	uint64_t now;
+	unsigned int i;
+	int ret;
+
+	if (!export.textfile && !export.shm_name) {
+		warnx("nothing to export to");
+		return -1;
+	}
+
+	if (export.shm_name && export_shm_open(platform) < 0)
+		return -1;
+
+	values = calloc(nclks, sizeof(*values));
+	export.pending = calloc(nclks, sizeof(*export.pending));
+	if (!values || !export.pending) {
+		warn("failed to allocate export buffer");
+		return -1;
+	}
+	export.nvalues = nclks;
+
+	if (export.textfile) {
+		ret = pthread_create(&export.thread, NULL, export_publisher, NULL);
+		if (ret) {
+			warnx("failed to start the publisher thread: %s", strerror(ret));
+			return -1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for (;;) {
+		for (i = 0; i < nclks; i++) {
+			values[i].clk = &clks[i];
+			memset(&values[i].m, 0, sizeof(values[i].m));
+			measure_clock(&clks[i], &values[i].m);
+			values[i].realtime = export_now(CLOCK_REALTIME);
+			values[i].monotonic = export_now(CLOCK_MONOTONIC);
+
+			if (export.shm)
+				export_shm_update(indexes[i], &values[i]);
+		}
+
+		if (export.textfile) {
+			pthread_mutex_lock(&export.lock);
+			memcpy(export.pending, values, nclks * sizeof(*values));
+			export.has_pending = true;
+			pthread_cond_signal(&export.cond);
+			pthread_mutex_unlock(&export.lock);
+		}
+
+		next.tv_sec += interval_us / 1000000;
+		next.tv_nsec += (interval_us % 1000000) * 1000;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+
+		/* Rounds overrunning the interval delay the following ones */
+		now = export_now(CLOCK_MONOTONIC);
+		if (next.tv_sec * 1000000000ULL + next.tv_nsec < now) {
+			next.tv_sec = now / 1000000000;
+			next.tv_nsec = now % 1000000000;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	return 0;
+}
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Memory backed stand-in for /dev/mem
+ *
+ * A sparse memfd, laid out like the physical address space of the SoC, is
+ * handed out in place of an opened /dev/mem. No register backend is
+ * installed, so the platform's premap hook, mmap_mux() and the MMIO
+ * accessors run exactly as they do on hardware.
+ *
+ * All registers behave as plain memory, except for the GCC debug counter
+ * which is emulated by a helper thread watching its control register. Once
+ * started the counter completes after the requested number of XO ticks, in
+ * real time, having counted a rate of FAKEMEM_RATE_STEP times one more than
+ * the selector of the GCC debug mux, so that the selection can be told from
+ * the result.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <debugcc.h>
+
+/* Covers the 32-bit physical address space all supported SoCs map their clock controllers in */
+#define FAKEMEM_SIZE		(1ULL << 32)
+
+#define FAKEMEM_RATE_STEP	1000000
+
+/* Interval at which the control register is polled */
+#define FAKEMEM_POLL_NS		10000
+
+static struct {
+	const struct gcc_mux *gcc;
+	volatile uint32_t *regs;
+	pthread_t thread;
+} fakemem;
+
+static uint64_t fakemem_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t fakemem_reg(unsigned int offset)
+{
+	return __atomic_load_n(&fakemem.regs[offset / 4], __ATOMIC_ACQUIRE);
+}
+
+static void fakemem_set(unsigned int offset, uint32_t val)
+{
+	__atomic_store_n(&fakemem.regs[offset / 4], val, __ATOMIC_RELEASE);
+}
+
+static uint32_t fakemem_count(unsigned int ticks)
+{
+	const struct gcc_mux *gcc = fakemem.gcc;
+	const struct debug_mux *mux = &gcc->mux;
+	unsigned int xo_rate = gcc->xo_rate ? : 4800000;
+	unsigned long selector = 0;
+
+	if (mux->mux_mask)
+		selector = (fakemem_reg(mux->mux_reg) & mux->mux_mask) >> mux->mux_shift;
+
+	return ((selector + 1) * FAKEMEM_RATE_STEP * (uint64_t)ticks / xo_rate) & GCC_MAX_COUNT;
+}
+
+static void *fakemem_counter(void *arg)
+{
+	const struct gcc_mux *gcc = fakemem.gcc;
+	struct timespec poll = { 0, FAKEMEM_POLL_NS };
+	unsigned int xo_rate = gcc->xo_rate ? : 4800000;
+	uint64_t done_at = 0;
+	bool running = false;
+	uint32_t ctl;
+
+	for (;;) {
+		ctl = fakemem_reg(gcc->debug_ctl_reg);
+
+		if (!(ctl & BIT(20))) {
+			/* Stopping the counter clears the status */
+			if (running || fakemem_reg(gcc->debug_status_reg))
+				fakemem_set(gcc->debug_status_reg, 0);
+			running = false;
+		} else if (!running) {
+			running = true;
+			done_at = fakemem_now() +
+				  (ctl & 0xfffff) * 1000000000ULL / xo_rate;
+		} else if (done_at && fakemem_now() >= done_at) {
+			fakemem_set(gcc->debug_status_reg,
+				    BIT(25) | fakemem_count(ctl & 0xfffff));
+			done_at = 0;
+		}
+
+		nanosleep(&poll, NULL);
+	}
+
+	return NULL;
+}
+
+/**
+ * fakemem_init() - create a memory backed stand-in for /dev/mem
+ * @platform: platform whose GCC debug counter is to be emulated
+ *
+ * Return: file descriptor to be used in place of /dev/mem, or -1 on failure
+ */
+int fakemem_init(const struct debugcc_platform *platform)
+{
+	const struct gcc_mux *gcc;
+	void *base;
+	int ret;
+	int fd;
+
+	gcc = platform_gcc(platform);
+	if (!gcc) {
+		warnx("%s has no GCC debug counter to emulate", platform->name);
+		return -1;
+	}
+
+	fd = memfd_create("debugcc-devmem", MFD_CLOEXEC);
+	if (fd < 0) {
+		warn("failed to create memfd");
+		return -1;
+	}
+
+	if (ftruncate(fd, FAKEMEM_SIZE) < 0) {
+		warn("failed to size memfd");
+		goto close;
+	}
+
+	/* The helper thread maps the counter on its own, unaffected by debugcc's mappings */
+	base = mmap(NULL, gcc->mux.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, gcc->mux.phys);
+	if (base == MAP_FAILED) {
+		warn("failed to map the GCC debug counter");
+		goto close;
+	}
+
+	fakemem.gcc = gcc;
+	fakemem.regs = base;
+
+	ret = pthread_create(&fakemem.thread, NULL, fakemem_counter, NULL);
+	if (ret) {
+		errno = ret;
+		warn("failed to start the counter thread");
+		munmap(base, gcc->mux.size);
+		goto close;
+	}
+
+	return fd;
+
+close:
+	close(fd);
+
+	return -1;
+}
@@ -0,0 +1,380 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Convert the measure_clk table of a platforms/<name>.c into a packed,
+# read-only clock_table: clock names go into a single string pool referenced
+# by 32-bit offsets, debug muxes are referenced by index into a small table
+# and selectors and fixed dividers are stored as 16 and 8-bit values.
+#
+# The rest of the source is passed through unmodified.
+#
+# With --binary, the platform is instead compiled into a description file to
+# be loaded at runtime by "debugcc -f", see loader.c for the format.
+
+import re
+import struct
+import sys
+
+TABLE_RE = re.compile(r'^static struct measure_clk (\w+)\[\] = \{\n(.*?)^\};\n',
+                      re.MULTILINE | re.DOTALL)
+ROW_RE = re.compile(r'\{\s*"([^"]+)"\s*,\s*&([\w.]+)\s*,\s*(0x[0-9a-fA-F]+|\d+)\s*'
+                    r'(?:,\s*(\d+)\s*)?,?\s*\}')
+COMMENT_RE = re.compile(r'/\*.*?\*/|//[^\n]*', re.DOTALL)
+DEFINE_RE = re.compile(r'^#define\s+(\w+)\s+(.+)$', re.MULTILINE)
+STRUCT_RE = re.compile(r'^(?:static\s+)?struct\s+\w+\s+(\w+)\s*=\s*\{', re.MULTILINE)
+PLATFORM_RE = re.compile(r'struct\s+debugcc_platform\s+\w+\s*=\s*\{\s*"([^"]+)"')
+
+PLATFORM_FILE_MAGIC = b'DEBUGCC'
+PLATFORM_FILE_VERSION = 1
+PLATFORM_FILE_NO_NAME = 0xffffffff
+PLATFORM_FILE_NO_PARENT = 0xff
+
+HEADER_FMT = '<8s9I'
+MUX_FMT = '<Q2I2BHI9I5I'
+CLOCK_FMT = '<IHBB'
+
+MEASURE = {
+    'measure_leaf': 0,
+    'measure_gcc': 1,
+    'measure_mccc': 2,
+}
+
+
+def error(path, msg):
+    sys.stderr.write('%s: %s\n' % (path, msg))
+    sys.exit(1)
+
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '\\0"'
+
+
+def parse_table(path, body):
+    """Return the rows of the table as (name, mux, selector, div, conds)"""
+    rows = []
+    conds = []
+
+    for line in COMMENT_RE.sub('', body).splitlines():
+        line = line.strip()
+        if not line:
+            continue
+
+        if line.startswith('#'):
+            directive = line[1:].strip().split()[0]
+            if directive in ('if', 'ifdef', 'ifndef'):
+                conds.append(line)
+            elif directive == 'endif':
+                conds.pop()
+            else:
+                error(path, 'unsupported directive in clock table: %s' % line)
+            continue
+
+        if line in ('{}', '{},', '{ },'):
+            continue
+
+        for m in ROW_RE.finditer(line):
+            name, mux, sel, div = m.groups()
+            rows.append((name, mux, int(sel, 0), int(div or 0), tuple(conds)))
+
+        if not ROW_RE.search(line):
+            error(path, 'malformed clock table entry: %s' % line)
+
+    return rows
+
+
+def emit_conds(out, prev, cur):
+    if prev == cur:
+        return
+    for _ in prev:
+        out.append('#endif')
+    for cond in cur:
+        out.append(cond)
+
+
+def generate(path, ident, rows):
+    out = []
+
+    # Muxes only used conditionally go last, designated indices keep the
+    # indices stable regardless of which conditions are met
+    muxes = {}
+    for name, mux, sel, div, conds in sorted(rows, key=lambda r: len(r[4])):
+        muxes.setdefault(mux, (len(muxes), conds))
+
+    offsets = {}
+    pool = []
+    size = 0
+    for name, mux, sel, div, conds in rows:
+        if name in offsets:
+            continue
+        offsets[name] = size
+        pool.append(name)
+        size += len(name) + 1
+
+    out.append('static const char %s_names[] =' % ident)
+    for name in pool:
+        out.append('\t' + c_string(name))
+    out.append('\t;')
+    out.append('')
+
+    out.append('static struct debug_mux *const %s_muxes[] = {' % ident)
+    conds = ()
+    for mux, (idx, mux_conds) in sorted(muxes.items(), key=lambda m: m[1][0]):
+        emit_conds(out, conds, mux_conds)
+        conds = mux_conds
+        out.append('\t[%d] = &%s,' % (idx, mux))
+    emit_conds(out, conds, ())
+    out.append('};')
+    out.append('')
+
+    if len(muxes) > 0x100:
+        error(path, 'too many debug muxes')
+
+    out.append('static const struct clock_entry %s_entries[] = {' % ident)
+    conds = ()
+    for name, mux, sel, div, row_conds in rows:
+        if sel > 0xffff:
+            error(path, 'selector of %s out of range' % name)
+        if div > 0xff:
+            error(path, 'fixed_div of %s out of range' % name)
+
+        emit_conds(out, conds, row_conds)
+        conds = row_conds
+        out.append('\t{ %d, %#x, %d, %d },' % (offsets[name], sel, muxes[mux][0], div))
+    emit_conds(out, conds, ())
+    out.append('};')
+    out.append('')
+
+    out.append('static const struct clock_table %s = {' % ident)
+    out.append('\t.names = %s_names,' % ident)
+    out.append('\t.muxes = %s_muxes,' % ident)
+    out.append('\t.nmuxes = sizeof(%s_muxes) / sizeof(%s_muxes[0]),' % (ident, ident))
+    out.append('\t.entries = %s_entries,' % ident)
+    out.append('\t.count = sizeof(%s_entries) / sizeof(%s_entries[0]),' % (ident, ident))
+    out.append('};')
+
+    return '\n'.join(out) + '\n'
+
+
+def c_eval(path, expr, defines):
+    """Evaluate a constant C expression of a mux initializer"""
+    for _ in range(8):
+        expanded = re.sub(r'\b[A-Za-z_]\w*\b',
+                          lambda m: '(%s)' % defines[m.group(0)]
+                          if m.group(0) in defines else m.group(0), expr)
+        if expanded == expr:
+            break
+        expr = expanded
+
+    expr = re.sub(r'\b(0x[0-9a-fA-F]+|\d+)[uUlL]+\b', r'\1', expr)
+    expr = expr.replace('/', '//')
+
+    try:
+        return int(eval(expr, {'__builtins__': {}}, {
+            'BIT': lambda x: 1 << x,
+            'GENMASK': lambda h, l: ((1 << (h + 1)) - 1) & ~((1 << l) - 1),
+        }))
+    except Exception:
+        error(path, 'unable to evaluate "%s"' % expr)
+
+
+def parse_init(body):
+    """Split the designated initializers of a struct into a dict"""
+    fields = {}
+    depth = 0
+    start = 0
+
+    for i, c in enumerate(body + ','):
+        if c in '{(':
+            depth += 1
+        elif c in '})':
+            depth -= 1
+        elif c == ',' and depth == 0:
+            item = body[start:i].strip()
+            start = i + 1
+            m = re.match(r'\.(\w+)\s*=\s*(.*)$', item, re.DOTALL)
+            if not m:
+                continue
+            value = m.group(2).strip()
+            if value.startswith('{'):
+                value = parse_init(value[1:-1])
+            fields[m.group(1)] = value
+
+    return fields
+
+
+def parse_structs(src):
+    structs = {}
+
+    for m in STRUCT_RE.finditer(src):
+        depth = 1
+        i = m.end()
+        while depth:
+            depth += {'{': 1, '}': -1}.get(src[i], 0)
+            i += 1
+        structs[m.group(1)] = parse_init(src[m.end():i - 1])
+
+    return structs
+
+
+def cond_met(path, cond, defines):
+    directive, _, expr = cond[1:].strip().partition(' ')
+    expr = expr.strip()
+    if directive == 'ifdef':
+        return expr in defines
+    if directive == 'ifndef':
+        return expr not in defines
+    return c_eval(path, expr, defines) != 0
+
+
+def generate_binary(path, src, rows):
+    src = COMMENT_RE.sub('', src)
+    defines = dict((n, v.strip()) for n, v in DEFINE_RE.findall(src))
+    structs = parse_structs(src)
+
+    m = PLATFORM_RE.search(src)
+    if not m:
+        error(path, 'no platform found')
+    platform = m.group(1)
+
+    rows = [r for r in rows if all(cond_met(path, c, defines) for c in r[4])]
+
+    def lookup(ref):
+        # "&gcc.mux" or "&cam_cc", returns the struct and its debug_mux
+        name, _, member = ref.lstrip('&').partition('.')
+        if name not in structs:
+            error(path, 'unknown debug mux %s' % ref)
+        fields = structs[name]
+        return (name, fields[member] if member else fields)
+
+    # Order muxes by depth, so parents always precede their children
+    muxes = {}
+    pending = ['&' + r[1] for r in rows]
+    while pending:
+        key, mux = lookup(pending.pop())
+        if key in muxes:
+            continue
+        muxes[key] = mux
+        if 'parent' in mux:
+            pending.append(mux['parent'])
+
+    def depth(key):
+        mux = muxes[key]
+        return depth(lookup(mux['parent'])[0]) + 1 if 'parent' in mux else 0
+
+    order = sorted(muxes, key=depth)
+    index = dict((key, i) for i, key in enumerate(order))
+
+    if len(order) >= PLATFORM_FILE_NO_PARENT:
+        error(path, 'too many debug muxes')
+
+    pool = bytearray()
+    offsets = {}
+
+    def string(s):
+        if s not in offsets:
+            offsets[s] = len(pool)
+            pool.extend(s.encode() + b'\0')
+        return offsets[s]
+
+    name = string(platform)
+    for row in rows:
+        string(row[0])
+
+    mux_data = bytearray()
+    for key in order:
+        mux = muxes[key]
+        fields = structs[key]
+
+        def val(f, d=mux):
+            return c_eval(path, d[f], defines) if f in d else 0
+
+        measure = mux.get('measure', 'measure_leaf')
+        if measure not in MEASURE:
+            error(path, '%s uses custom measure function %s' % (key, measure))
+
+        block_name = PLATFORM_FILE_NO_NAME
+        if 'block_name' in mux:
+            block_name = string(mux['block_name'].strip('"'))
+
+        parent = PLATFORM_FILE_NO_PARENT
+        if 'parent' in mux:
+            parent = index[lookup(mux['parent'])[0]]
+
+        mux_data += struct.pack(MUX_FMT,
+                                val('phys'), val('size'), block_name,
+                                MEASURE[measure], parent, 0, val('parent_mux_val'),
+                                val('enable_reg'), val('enable_mask'),
+                                val('mux_reg'), val('mux_mask'), val('mux_shift'),
+                                val('div_reg'), val('div_shift'), val('div_mask'),
+                                val('div_val'),
+                                val('xo_rate', fields), val('xo_div4_reg', fields),
+                                val('xo_div4_val', fields), val('debug_ctl_reg', fields),
+                                val('debug_status_reg', fields))
+
+    clock_data = bytearray()
+    for clk, mux, sel, div, conds in rows:
+        if sel > 0xffff or div > 0xff:
+            error(path, 'selector or fixed_div of %s out of range' % clk)
+        clock_data += struct.pack(CLOCK_FMT, offsets[clk], sel,
+                                  index[lookup('&' + mux)[0]], div)
+
+    names_offset = struct.calcsize(HEADER_FMT)
+    muxes_offset = (names_offset + len(pool) + 7) & ~7
+    clocks_offset = muxes_offset + len(mux_data)
+    size = clocks_offset + len(clock_data)
+
+    header = struct.pack(HEADER_FMT, PLATFORM_FILE_MAGIC, PLATFORM_FILE_VERSION, size,
+                         name, names_offset, len(pool), muxes_offset, len(order),
+                         clocks_offset, len(rows))
+
+    return (header + pool + bytes(muxes_offset - names_offset - len(pool)) +
+            mux_data + clock_data)
+
+
+def main():
+    args = sys.argv[1:]
+    binary = args[:1] == ['--binary']
+    if binary:
+        args = args[1:]
+
+    if len(args) != 2:
+        sys.stderr.write('usage: %s [--binary] <platform.c> <output>\n' % sys.argv[0])
+        sys.exit(1)
+
+    path, output = args
+
+    with open(path) as f:
+        src = f.read()
+
+    m = TABLE_RE.search(src)
+    if not m:
+        error(path, 'no clock table found')
+
+    ident = m.group(1)
+    rows = parse_table(path, m.group(2))
+
+    if binary:
+        data = generate_binary(path, src, rows)
+        with open(output, 'wb') as f:
+            f.write(data)
+        return
+
+    head = src[:m.start()]
+    tail = src[m.end():]
+
+    # The platform refers to the table by name, make that a pointer
+    tail, n = re.subn(r'\b%s\b' % ident, '&' + ident, tail)
+    if n != 1:
+        error(path, 'expected a single reference to %s' % ident)
+
+    with open(output, 'w') as f:
+        f.write('/* Autogenerated from %s, do not edit */\n' % path)
+        f.write('#line 1 "%s"\n' % path)
+        f.write(head)
+        f.write(generate(path, ident, rows))
+        f.write('#line %d "%s"\n' % (src.count('\n', 0, m.end()) + 1, path))
+        f.write(tail)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,303 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Platform description files
+ *
+ * A platform can be described by a file loaded at runtime rather than being
+ * built in, as produced by "gen-platform.py --binary" from a platforms/<soc>.c
+ * source. The file is mapped read-only and its string pool and clock entries
+ * are used in place, in the same packed form as the built-in tables. Only the
+ * handful of debug muxes is instantiated, as these carry the mapped base.
+ *
+ * All fields are little-endian and offsets are relative to the start of the
+ * file:
+ *
+ *   struct platform_file_header
+ *   char names[]                          NUL-terminated strings
+ *   struct platform_file_mux muxes[]      parents precede their children
+ *   struct clock_entry clocks[]           clk_mux indexes muxes[]
+ *
+ * Debug muxes using a custom measure function, or platforms relying on a
+ * premap hook, can't be described this way.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <debugcc.h>
+
+#define PLATFORM_FILE_MAGIC	"DEBUGCC"
+#define PLATFORM_FILE_VERSION	1
+
+#define PLATFORM_FILE_NO_NAME	0xffffffff
+#define PLATFORM_FILE_NO_PARENT	0xff
+
+enum platform_file_measure {
+	PLATFORM_FILE_LEAF,
+	PLATFORM_FILE_GCC,
+	PLATFORM_FILE_MCCC,
+};
+
+struct platform_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t size;
+
+	uint32_t name;
+
+	uint32_t names_offset;
+	uint32_t names_size;
+
+	uint32_t muxes_offset;
+	uint32_t nmuxes;
+
+	uint32_t clocks_offset;
+	uint32_t nclocks;
+};
+
+struct platform_file_mux {
+	uint64_t phys;
+	uint32_t size;
+	uint32_t block_name;
+
+	uint8_t measure;
+	uint8_t parent;
+	uint16_t reserved;
+	uint32_t parent_mux_val;
+
+	uint32_t enable_reg;
+	uint32_t enable_mask;
+
+	uint32_t mux_reg;
+	uint32_t mux_mask;
+	uint32_t mux_shift;
+
+	uint32_t div_reg;
+	uint32_t div_shift;
+	uint32_t div_mask;
+	uint32_t div_val;
+
+	/* PLATFORM_FILE_GCC only */
+	uint32_t xo_rate;
+	uint32_t xo_div4_reg;
+	uint32_t xo_div4_val;
+	uint32_t debug_ctl_reg;
+	uint32_t debug_status_reg;
+};
+
+/* Registers are accessed through the mapping of the mux, @size bytes long */
+static bool platform_file_reg(const struct platform_file_mux *fmux, uint32_t reg)
+{
+	return !(reg % 4) && reg <= fmux->size && fmux->size - reg >= 4;
+}
+
+static bool platform_file_regs(const struct platform_file_mux *fmux)
+{
+	if ((fmux->enable_mask && !platform_file_reg(fmux, fmux->enable_reg)) ||
+	    (fmux->mux_mask && !platform_file_reg(fmux, fmux->mux_reg)) ||
+	    (fmux->div_mask && !platform_file_reg(fmux, fmux->div_reg)))
+		return false;
+
+	if (fmux->measure == PLATFORM_FILE_GCC &&
+	    (!platform_file_reg(fmux, fmux->xo_div4_reg) ||
+	     !platform_file_reg(fmux, fmux->debug_ctl_reg) ||
+	     !platform_file_reg(fmux, fmux->debug_status_reg)))
+		return false;
+
+	return true;
+}
+
+static int platform_file_check(const char *path, const void *base, size_t size)
+{
+	const struct platform_file_header *hdr = base;
+	const struct platform_file_mux *fmux;
+	const struct clock_entry *entry;
+	const char *names;
+	unsigned int i;
+
+	if (size < sizeof(*hdr) || memcmp(hdr->magic, PLATFORM_FILE_MAGIC, sizeof(hdr->magic))) {
+		warnx("%s: not a platform description file", path);
+		return -1;
+	}
+
+	if (hdr->version != PLATFORM_FILE_VERSION) {
+		warnx("%s: unsupported version %u", path, hdr->version);
+		return -1;
+	}
+
+	if (hdr->size != size ||
+	    !hdr->names_size || hdr->names_offset > size ||
+	    hdr->names_size > size - hdr->names_offset ||
+	    hdr->muxes_offset % 8 || hdr->muxes_offset > size ||
+	    hdr->nmuxes > PLATFORM_FILE_NO_PARENT ||
+	    hdr->nmuxes * sizeof(*fmux) > size - hdr->muxes_offset ||
+	    hdr->clocks_offset % 4 || hdr->clocks_offset > size ||
+	    hdr->nclocks > (size - hdr->clocks_offset) / sizeof(*entry)) {
+		warnx("%s: truncated or corrupt", path);
+		return -1;
+	}
+
+	names = base + hdr->names_offset;
+	if (names[hdr->names_size - 1] != '\0' || hdr->name >= hdr->names_size) {
+		warnx("%s: corrupt string table", path);
+		return -1;
+	}
+
+	fmux = base + hdr->muxes_offset;
+	for (i = 0; i < hdr->nmuxes; i++, fmux++) {
+		if (fmux->measure > PLATFORM_FILE_MCCC ||
+		    (fmux->parent != PLATFORM_FILE_NO_PARENT && fmux->parent >= i) ||
+		    (fmux->block_name != PLATFORM_FILE_NO_NAME &&
+		     fmux->block_name >= hdr->names_size) ||
+		    !platform_file_regs(fmux)) {
+			warnx("%s: corrupt debug mux %u", path, i);
+			return -1;
+		}
+	}
+
+	/* The selector of clocks measured by an MCCC is the offset of their register */
+	fmux = base + hdr->muxes_offset;
+	entry = base + hdr->clocks_offset;
+	for (i = 0; i < hdr->nclocks; i++, entry++) {
+		if (entry->name >= hdr->names_size || entry->clk_mux >= hdr->nmuxes ||
+		    (fmux[entry->clk_mux].measure == PLATFORM_FILE_MCCC &&
+		     !platform_file_reg(&fmux[entry->clk_mux], entry->mux))) {
+			warnx("%s: corrupt clock %u", path, i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void platform_file_mux(struct gcc_mux *gcc, const struct platform_file_mux *fmux,
+			      const char *names, struct gcc_mux *muxes)
+{
+	struct debug_mux *mux = &gcc->mux;
+
+	mux->phys = fmux->phys;
+	mux->size = fmux->size;
+	if (fmux->block_name != PLATFORM_FILE_NO_NAME)
+		mux->block_name = names + fmux->block_name;
+
+	if (fmux->parent != PLATFORM_FILE_NO_PARENT)
+		mux->parent = &muxes[fmux->parent].mux;
+	mux->parent_mux_val = fmux->parent_mux_val;
+
+	mux->enable_reg = fmux->enable_reg;
+	mux->enable_mask = fmux->enable_mask;
+	mux->mux_reg = fmux->mux_reg;
+	mux->mux_mask = fmux->mux_mask;
+	mux->mux_shift = fmux->mux_shift;
+	mux->div_reg = fmux->div_reg;
+	mux->div_shift = fmux->div_shift;
+	mux->div_mask = fmux->div_mask;
+	mux->div_val = fmux->div_val;
+
+	switch (fmux->measure) {
+	case PLATFORM_FILE_GCC:
+		mux->measure = measure_gcc;
+		gcc->xo_rate = fmux->xo_rate;
+		gcc->xo_div4_reg = fmux->xo_div4_reg;
+		gcc->xo_div4_val = fmux->xo_div4_val;
+		gcc->debug_ctl_reg = fmux->debug_ctl_reg;
+		gcc->debug_status_reg = fmux->debug_status_reg;
+		break;
+	case PLATFORM_FILE_MCCC:
+		mux->measure = measure_mccc;
+		break;
+	default:
+		mux->measure = measure_leaf;
+		break;
+	}
+}
+
+/**
+ * platform_load() - load a platform description file
+ * @path: path of the file
+ *
+ * Return: the described platform, or NULL on failure
+ */
+const struct debugcc_platform *platform_load(const char *path)
+{
+	const struct platform_file_header *hdr;
+	const struct platform_file_mux *fmux;
+	struct debugcc_platform *platform;
+	struct debug_mux **mux_table;
+	struct clock_table *table;
+	struct gcc_mux *muxes;
+	struct stat st;
+	const char *names;
+	void *base;
+	unsigned int i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		warn("failed to open %s", path);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		warnx("%s: empty or unreadable", path);
+		close(fd);
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		warn("failed to map %s", path);
+		return NULL;
+	}
+
+	if (platform_file_check(path, base, st.st_size) < 0)
+		goto unmap;
+
+	hdr = base;
+	names = base + hdr->names_offset;
+
+	platform = calloc(1, sizeof(*platform));
+	table = calloc(1, sizeof(*table));
+	mux_table = calloc(hdr->nmuxes, sizeof(*mux_table));
+	muxes = calloc(hdr->nmuxes, sizeof(*muxes));
+	if (!platform || !table || !mux_table || !muxes) {
+		warnx("failed to allocate platform");
+		goto free;
+	}
+
+	fmux = base + hdr->muxes_offset;
+	for (i = 0; i < hdr->nmuxes; i++) {
+		platform_file_mux(&muxes[i], &fmux[i], names, muxes);
+		mux_table[i] = &muxes[i].mux;
+	}
+
+	table->names = names;
+	table->muxes = mux_table;
+	table->nmuxes = hdr->nmuxes;
+	table->entries = base + hdr->clocks_offset;
+	table->count = hdr->nclocks;
+
+	platform->name = names + hdr->name;
+	platform->clocks = table;
+
+	return platform;
+
+free:
+	free(muxes);
+	free(mux_table);
+	free(table);
+	free(platform);
+unmap:
+	munmap(base, st.st_size);
+
+	return NULL;
+}
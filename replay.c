@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Replay of recorded register traces
+ *
+ * A trace recorded with -t on a device is served back in place of the
+ * hardware: every access must match the next record of the trace, reads
+ * return the recorded value and writes and barriers are only checked. As the
+ * recorded counter values steer debugcc through the same windows, a run with
+ * the same arguments reproduces the recorded access sequence exactly, so
+ * sweeps can be replayed on any host to benchmark the software overhead or to
+ * verify that a change doesn't alter the register programming. The first
+ * access diverging from the trace terminates the run. Counts are converted
+ * with the calibration recorded in the trace, not that of the host.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <debugcc.h>
+
+#define REPLAY_MAX_BLOCKS	32
+
+struct replay_block {
+	void *base;
+	size_t size;
+	unsigned long phys;
+};
+
+static struct {
+	const struct trace_header *header;
+	const struct trace_record *records;
+	uint64_t pos;
+	uint64_t served;
+
+	struct replay_block blocks[REPLAY_MAX_BLOCKS];
+	unsigned int nblocks;
+} replay;
+
+static const char *const replay_types[] = {
+	[TRACE_READ] = "read",
+	[TRACE_WRITE] = "write",
+	[TRACE_BARRIER] = "barrier",
+};
+
+static unsigned long replay_phys(void *ptr)
+{
+	const struct replay_block *block;
+	unsigned int i;
+
+	for (i = 0; i < replay.nblocks; i++) {
+		block = &replay.blocks[i];
+
+		if (ptr >= block->base && ptr < block->base + block->size)
+			return block->phys + (ptr - block->base);
+	}
+
+	errx(1, "replay: access to unmapped address %p", ptr);
+}
+
+static void replay_diverge(unsigned int type, unsigned long phys, uint32_t val)
+{
+	const struct trace_record *rec = &replay.records[replay.pos];
+
+	fflush(stdout);
+
+	if (replay.pos == replay.header->count)
+		errx(1, "replay: %s %#lx = %#x beyond the end of the trace",
+		     replay_types[type], phys, val);
+
+	errx(1, "replay: diverged at record %lu, expected %s %#lx = %#x, got %s %#lx = %#x",
+	     (unsigned long)replay.pos, replay_types[rec->type], (unsigned long)rec->phys,
+	     rec->val, replay_types[type], phys, val);
+}
+
+/* Match an access against the next record, returning the recorded value */
+static uint32_t replay_next(unsigned int type, unsigned long phys, uint32_t val)
+{
+	const struct trace_record *rec = &replay.records[replay.pos];
+
+	if (replay.pos == replay.header->count || rec->type != type || rec->phys != phys ||
+	    (type != TRACE_READ && rec->val != val))
+		replay_diverge(type, phys, val);
+
+	/* Folded reads are served as often as they were recorded */
+	if (replay.served++ == rec->repeat) {
+		replay.served = 0;
+		replay.pos++;
+	}
+
+	return rec->val;
+}
+
+static void *replay_map(struct debug_mux *mux)
+{
+	struct replay_block *block;
+	void *base;
+
+	if (replay.nblocks == REPLAY_MAX_BLOCKS) {
+		warnx("replay: too many blocks");
+		return NULL;
+	}
+
+	/* Only reserve the address range, all accesses go through replay_ops */
+	base = mmap(NULL, mux->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	block = &replay.blocks[replay.nblocks++];
+	block->base = base;
+	block->size = mux->size;
+	block->phys = mux->phys;
+
+	return base;
+}
+
+static uint32_t replay_read(void *ptr)
+{
+	return replay_next(TRACE_READ, replay_phys(ptr), 0);
+}
+
+static void replay_write(uint32_t val, void *ptr)
+{
+	replay_next(TRACE_WRITE, replay_phys(ptr), val);
+}
+
+static void replay_barrier(enum mmio_barrier type)
+{
+	replay_next(TRACE_BARRIER, 0, type);
+}
+
+static const struct mmio_ops replay_ops = {
+	.map = replay_map,
+	.read = replay_read,
+	.write = replay_write,
+	.barrier = replay_barrier,
+};
+
+/**
+ * replay_init() - serve register accesses from a recorded trace
+ * @path: trace file, as written by trace.c
+ *
+ * Return: name of the platform the trace was recorded on, or NULL on failure
+ */
+const char *replay_init(const char *path)
+{
+	const struct trace_header *header;
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		warn("failed to open %s", path);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*header)) {
+		warnx("%s: not a trace file", path);
+		close(fd);
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		warn("failed to map %s", path);
+		return NULL;
+	}
+
+	header = base;
+	if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) ||
+	    header->version != TRACE_VERSION ||
+	    header->count > (st.st_size - sizeof(*header)) / sizeof(struct trace_record) ||
+	    !memchr(header->platform, '\0', sizeof(header->platform))) {
+		warnx("%s: not a trace file, or truncated", path);
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	if (header->dropped) {
+		warnx("%s: %lu records were dropped while recording, can't replay",
+		      path, (unsigned long)header->dropped);
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	replay.header = header;
+	replay.records = base + sizeof(*header);
+	mmio_ops = &replay_ops;
+
+	return header->platform;
+}
+
+/**
+ * replay_calibration() - apply the calibration the trace was recorded with
+ * @platform: platform being replayed
+ *
+ * The calibration stored on the host replaying the trace is never used, as
+ * it would convert the recorded counts differently than the recording did.
+ */
+void replay_calibration(const struct debugcc_platform *platform)
+{
+	struct gcc_mux *gcc = platform_gcc(platform);
+
+	if (!gcc || !replay.header->xo_rate)
+		return;
+
+	gcc->xo_rate = replay.header->xo_rate;
+	gcc->count_offset = replay.header->count_offset;
+	gcc->tick_offset = replay.header->tick_offset;
+	gcc->calibrated = true;
+}
+
+/**
+ * replay_report() - check that the whole trace has been replayed
+ *
+ * Return: 0 if the run matched the trace, -1 otherwise
+ */
+int replay_report(void)
+{
+	fflush(stdout);
+
+	if (replay.pos != replay.header->count) {
+		warnx("replay: run ended after %lu of %lu records",
+		      (unsigned long)replay.pos, (unsigned long)replay.header->count);
+		return -1;
+	}
+
+	fprintf(stderr, "replay: %lu records matched\n", (unsigned long)replay.pos);
+
+	return 0;
+}
@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Clock residency estimation
+ *
+ * A single measurement averages the rate over its window, so it can't tell a
+ * clock running at half its rate from one gated half of the time. Sampling a
+ * set of clocks round-robin with the "sample" preset over a period instead
+ * gives the fraction of samples each clock was on, the number of on/off
+ * transitions seen and a histogram of the rates it ran at. Each clock is
+ * measured once beforehand, so that slow clocks get a window long enough for
+ * them to count, see measure_sample_ticks().
+ *
+ * Rates within 1% of each other are counted as the same level, up to
+ * RESIDENCY_LEVELS levels per clock. A clock gated during part of a sample
+ * window shows up as a level of its own, at a fraction of its rate.
+ */
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <debugcc.h>
+
+#define RESIDENCY_LEVELS	8
+
+struct residency_level {
+	unsigned long rate;
+	unsigned long samples;
+};
+
+struct residency {
+	unsigned long samples;
+	unsigned long on;
+	unsigned long faults;
+	unsigned long transitions;
+	unsigned long other;
+	bool last_on;
+
+	struct residency_level levels[RESIDENCY_LEVELS];
+	unsigned int nlevels;
+};
+
+static void residency_add(struct residency *r, const struct measurement *m)
+{
+	struct residency_level *level;
+	unsigned int i;
+	bool on;
+
+	if (m->error) {
+		r->faults++;
+		return;
+	}
+
+	on = m->rate != 0;
+	if (r->samples && on != r->last_on)
+		r->transitions++;
+	r->last_on = on;
+
+	r->samples++;
+	if (!on)
+		return;
+	r->on++;
+
+	for (i = 0; i < r->nlevels; i++) {
+		level = &r->levels[i];
+
+		if (m->rate / 100 >= (m->rate > level->rate ? m->rate - level->rate :
+							       level->rate - m->rate)) {
+			level->samples++;
+			return;
+		}
+	}
+
+	if (r->nlevels == RESIDENCY_LEVELS) {
+		r->other++;
+		return;
+	}
+
+	level = &r->levels[r->nlevels++];
+	level->rate = m->rate;
+	level->samples = 1;
+}
+
+static int residency_cmp(const void *a, const void *b)
+{
+	const struct residency_level *la = a;
+	const struct residency_level *lb = b;
+
+	if (la->samples != lb->samples)
+		return la->samples < lb->samples ? 1 : -1;
+
+	return la->rate < lb->rate ? 1 : la->rate > lb->rate ? -1 : 0;
+}
+
+static void residency_print(const struct measure_clk *clk, struct residency *r)
+{
+	unsigned long samples = r->samples ? : 1;
+	unsigned int i;
+
+	printf("%50s: on %5.1f%% of %lu samples, %lu transitions",
+	       clk->name, r->on * 100.0 / samples, r->samples, r->transitions);
+	if (r->faults)
+		printf(", %lu faults", r->faults);
+	printf("\n");
+
+	qsort(r->levels, r->nlevels, sizeof(*r->levels), residency_cmp);
+
+	for (i = 0; i < r->nlevels; i++)
+		printf("%50s  %12.6fMHz %5.1f%%\n", "", r->levels[i].rate / 1000000.0,
+		       r->levels[i].samples * 100.0 / samples);
+	if (r->other)
+		printf("%50s  %15s %5.1f%%\n", "", "other", r->other * 100.0 / samples);
+	if (r->on != r->samples)
+		printf("%50s  %15s %5.1f%%\n", "", "off", (r->samples - r->on) * 100.0 / samples);
+}
+
+/**
+ * residency_run() - estimate the residency of clocks in their rates
+ * @clks: clocks to sample
+ * @nclks: number of clocks in @clks
+ * @duration_us: time to sample for
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int residency_run(const struct measure_clk *clks, unsigned int nclks,
+		  unsigned long duration_us)
+{
+	unsigned long resolution;
+	struct residency *res;
+	struct measurement m;
+	unsigned int *ticks;
+	uint64_t end;
+	unsigned int i;
+
+	res = calloc(nclks, sizeof(*res));
+	ticks = calloc(nclks, sizeof(*ticks));
+	if (!res || !ticks) {
+		warn("failed to allocate residency counters");
+		free(ticks);
+		free(res);
+		return -1;
+	}
+
+	for (i = 0; i < nclks; i++) {
+		memset(&m, 0, sizeof(m));
+		measure_clock(&clks[i], &m);
+		ticks[i] = measure_sample_ticks(&clks[i], m.rate, &resolution);
+	}
+
+	measure_config_preset("sample");
+
+	end = arch_counter() + duration_us * arch_counter_freq() / 1000000;
+
+	do {
+		for (i = 0; i < nclks; i++) {
+			memset(&m, 0, sizeof(m));
+			measure_config.short_ticks = ticks[i];
+			measure_clock(&clks[i], &m);
+			residency_add(&res[i], &m);
+		}
+	} while (arch_counter() < end);
+
+	for (i = 0; i < nclks; i++)
+		residency_print(&clks[i], &res[i]);
+
+	free(ticks);
+	free(res);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * High rate sampling of directly read clocks
+ *
+ * Clocks whose rate is read back from a period register, such as the DDR
+ * clock reported by the memory controller clock controller (MCCC), need no
+ * counter window and can be sampled at a high rate, capturing transitions
+ * such as those of DDR DCVS which slower polling misses. The register is read
+ * in a tight loop and every decimate'th read is stored with a timestamp of
+ * the reference timer into a preallocated buffer, which is only printed once
+ * sampling has completed.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <debugcc.h>
+
+#define SAMPLE_MAX	(1 << 20)
+
+struct sample {
+	uint64_t timestamp;
+	uint32_t period;
+};
+
+/**
+ * sample_clock() - sample the rate of a directly read clock
+ * @clk: clock to sample
+ * @duration_us: time to sample for
+ * @decimate: store only every @decimate'th read
+ *
+ * Prints one line per stored sample, with its time in microseconds since the
+ * start of sampling and the rate in Hz.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int sample_clock(const struct measure_clk *clk, unsigned long duration_us,
+		 unsigned int decimate)
+{
+	uint64_t freq = arch_counter_freq();
+	struct measurement m = {};
+	struct sample *samples;
+	unsigned long reads = 0;
+	unsigned int count = 0;
+	unsigned long rate;
+	uint64_t start;
+	uint64_t end;
+	uint64_t now;
+	uint32_t period;
+	unsigned int i;
+	void *reg;
+
+	if (clk->clk_mux->measure != measure_mccc) {
+		warnx("%s can't be sampled directly", clk->name);
+		return -1;
+	}
+
+	if (!decimate)
+		decimate = 1;
+
+	samples = calloc(SAMPLE_MAX, sizeof(*samples));
+	if (!samples) {
+		warn("failed to allocate sample buffer");
+		return -1;
+	}
+
+	if (arbiter_acquire(0) < 0) {
+		warnx("debug mux busy");
+		free(samples);
+		return -1;
+	}
+
+	mux_prepare_enable(clk->clk_mux, clk->mux);
+	reg = clk->clk_mux->base + clk->mux;
+
+	start = arch_counter();
+	end = start + duration_us * freq / 1000000;
+
+	for (now = start; now < end && count < SAMPLE_MAX; reads++) {
+		period = readl(reg);
+		now = arch_counter();
+
+		if (reads % decimate)
+			continue;
+
+		samples[count].timestamp = now;
+		samples[count].period = period;
+		count++;
+	}
+
+	mux_disable(clk->clk_mux);
+
+	arbiter_release();
+
+	for (i = 0; i < count; i++) {
+		rate = samples[i].period ? 1000000000000ULL / samples[i].period : 0;
+		if (clk->fixed_div)
+			rate *= clk->fixed_div;
+
+		m.rate = rate;
+		timeline_sample(clk, &m, samples[i].timestamp);
+
+		printf("%12.3f %lu\n", (samples[i].timestamp - start) * 1000000.0 / freq, rate);
+	}
+
+	fflush(stdout);
+	fprintf(stderr, "sample: %lu reads, %u samples in %.1f ms%s\n", reads, count,
+		(now - start) * 1000.0 / freq, count == SAMPLE_MAX ? ", buffer full" : "");
+
+	free(samples);
+
+	return 0;
+}
@@ -0,0 +1,690 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Simulated register backend
+ *
+ * Every mapped block is backed by plain memory and the GCC debug counter is
+ * emulated in real time, counting a rate derived from the name of the
+ * selected clock.
+ * Relaxed writes are posted: they only become visible once a barrier is
+ * issued or another access hits the same block, which is what the
+ * architecture guarantees for device memory. A counter started while
+ * writes to other blocks are still in flight is reported as an ordering
+ * violation, as the measurement might be taken from the wrong clock.
+ *
+ * In dry-run mode the accesses are printed in program order instead and the
+ * counter completes instantly, while the time the measurement would take on
+ * hardware is estimated from the counter windows and the number of accesses.
+ * Values read back, and hence those written by read-modify-write sequences,
+ * are those of the simulated registers.
+ *
+ * Faults can be injected to provoke failure modes of the hardware, see
+ * sim_fault().
+ */
+
+#include <err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <debugcc.h>
+
+#define SIM_MAX_BLOCKS	32
+#define SIM_MAX_POSTED	64
+
+/* Rough cost of an uncached access to a clock controller */
+#define SIM_ACCESS_NS	500
+
+#define SIM_MAX_FAULTS	8
+
+enum sim_fault_type {
+	SIM_FAULT_NO_DONE,
+	SIM_FAULT_STUCK_STATUS,
+	SIM_FAULT_IGNORE_WRITES,
+	SIM_FAULT_SLOW,
+	SIM_FAULT_ALL_ONES,
+};
+
+static const char *const sim_fault_names[] = {
+	[SIM_FAULT_NO_DONE] = "no-done",
+	[SIM_FAULT_STUCK_STATUS] = "stuck-status",
+	[SIM_FAULT_IGNORE_WRITES] = "ignore-writes",
+	[SIM_FAULT_SLOW] = "slow",
+	[SIM_FAULT_ALL_ONES] = "all-ones",
+};
+
+/* A fault applies to the block named @block or the register at @phys, if set */
+struct sim_fault {
+	enum sim_fault_type type;
+	char *block;
+	unsigned long phys;
+	unsigned int factor;
+
+	unsigned long hits;
+};
+
+struct sim_block {
+	struct debug_mux *mux;
+	uint32_t *regs;
+};
+
+struct sim_write {
+	struct sim_block *block;
+	size_t offset;
+	uint32_t val;
+};
+
+static struct {
+	const struct debugcc_platform *platform;
+	struct gcc_mux *gcc;
+
+	struct sim_block blocks[SIM_MAX_BLOCKS];
+	unsigned int nblocks;
+
+	struct sim_write posted[SIM_MAX_POSTED];
+	unsigned int nposted;
+
+	struct measure_clk last_clk;
+	uint64_t done_at;
+	uint32_t status;
+
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long barriers;
+	unsigned long violations;
+
+	bool dry_run;
+	uint64_t elapsed_ns;
+	uint64_t clock_start;
+	unsigned int nclocks;
+
+	struct sim_fault faults[SIM_MAX_FAULTS];
+	unsigned int nfaults;
+} sim;
+
+static const unsigned long sim_rates[] = {
+	19200000, 37500000, 50000000, 75000000, 100000000, 150000000,
+	200000000, 300000000, 403000000, 600000000, 806000000, 1209600000,
+};
+
+/*
+ * Pick a stable, plausible rate for a clock based on its name, roughly one
+ * in five of the clocks not recognized as sleep or XO clocks is off.
+ */
+static unsigned long sim_clk_rate(const struct measure_clk *clk)
+{
+	const char *p;
+	uint32_t hash = 2166136261u;
+
+	for (p = clk->name; *p; p++)
+		hash = (hash ^ (uint8_t)*p) * 16777619u;
+
+	if (strstr(clk->name, "sleep"))
+		return 32764;
+
+	/* XO branches make for useful calibration references */
+	if (strstr(clk->name, "xo4"))
+		return 4800000;
+	if (strstr(clk->name, "xo"))
+		return 19200000;
+
+	if (hash % 5 == 0)
+		return 0;
+
+	return sim_rates[(hash / 5) % (sizeof(sim_rates) / sizeof(sim_rates[0]))];
+}
+
+static struct sim_block *sim_find_block(void *ptr, size_t *offset)
+{
+	struct sim_block *block;
+	unsigned int i;
+
+	for (i = 0; i < sim.nblocks; i++) {
+		block = &sim.blocks[i];
+
+		if (ptr >= (void *)block->regs &&
+		    ptr < (void *)block->regs + block->mux->size) {
+			*offset = ptr - (void *)block->regs;
+			return block;
+		}
+	}
+
+	errx(1, "sim: access to unmapped address %p", ptr);
+}
+
+static struct sim_block *sim_mux_block(const struct debug_mux *mux)
+{
+	unsigned int i;
+
+	for (i = 0; i < sim.nblocks; i++) {
+		if (sim.blocks[i].mux == mux)
+			return &sim.blocks[i];
+	}
+
+	return NULL;
+}
+
+static uint32_t sim_reg(const struct debug_mux *mux, unsigned int offset)
+{
+	struct sim_block *block = sim_mux_block(mux);
+
+	return block ? block->regs[offset / 4] : 0;
+}
+
+static unsigned int sim_mux_div(const struct debug_mux *mux)
+{
+	if (!mux->div_mask)
+		return 1;
+
+	return ((sim_reg(mux, mux->div_reg) & mux->div_mask) >> mux->div_shift) + 1;
+}
+
+/*
+ * Check if the current register state routes @clk to the counter, if so
+ * return the divider applied along the way.
+ */
+static unsigned int sim_clk_selected(const struct measure_clk *clk)
+{
+	const struct debug_mux *mux = clk->clk_mux;
+	unsigned long selector = clk->mux;
+	unsigned int div = 1;
+	uint32_t val;
+
+	for (; mux; selector = mux->parent_mux_val, mux = mux->parent) {
+		if (mux->mux_mask) {
+			val = sim_reg(mux, mux->mux_reg) & mux->mux_mask;
+			if (val != ((selector << mux->mux_shift) & mux->mux_mask))
+				return 0;
+		}
+
+		if (mux->enable_mask) {
+			val = sim_reg(mux, mux->enable_reg);
+			if ((val & mux->enable_mask) != mux->enable_mask)
+				return 0;
+		}
+
+		div *= sim_mux_div(mux);
+
+		if (mux == &sim.gcc->mux)
+			return div;
+	}
+
+	return 0;
+}
+
+static uint32_t sim_count(unsigned int ticks)
+{
+	const struct debugcc_platform *platform = sim.platform;
+	const struct measure_clk *clk = &sim.last_clk;
+	unsigned int xo_rate = sim.gcc->xo_rate ? : 4800000;
+	unsigned long rate;
+	unsigned int div = 0;
+	unsigned int i;
+
+	if (clk->name)
+		div = sim_clk_selected(clk);
+
+	for (i = 0; !div && i < platform_nclocks(platform); i++) {
+		platform_clock(platform, i, &sim.last_clk);
+		div = sim_clk_selected(clk);
+	}
+
+	if (!div) {
+		sim.last_clk.name = NULL;
+		return 0;
+	}
+
+	rate = sim_clk_rate(clk) / div;
+	if (clk->fixed_div)
+		rate /= clk->fixed_div;
+
+	return ((uint64_t)rate * ticks / xo_rate) & GCC_MAX_COUNT;
+}
+
+/* The faults emulated by the GCC debug counter, rather than any register */
+static bool sim_fault_counter(enum sim_fault_type type)
+{
+	return type == SIM_FAULT_NO_DONE || type == SIM_FAULT_STUCK_STATUS ||
+	       type == SIM_FAULT_SLOW;
+}
+
+/* Find an injected fault of @type affecting the register at @offset of @block */
+static struct sim_fault *sim_fault_find(enum sim_fault_type type,
+					const struct sim_block *block, size_t offset)
+{
+	const struct debug_mux *mux = block->mux;
+	struct sim_fault *fault;
+	const char *name;
+	unsigned int i;
+
+	name = mux == &sim.gcc->mux ? "gcc" : mux->block_name;
+
+	for (i = 0; i < sim.nfaults; i++) {
+		fault = &sim.faults[i];
+
+		if (fault->type != type)
+			continue;
+
+		if (fault->block && (!name || strcmp(fault->block, name)))
+			continue;
+
+		if (fault->phys && fault->phys != mux->phys + offset)
+			continue;
+
+		fault->hits++;
+		return fault;
+	}
+
+	return NULL;
+}
+
+/*
+ * Apply a posted write, @older is the oldest write to another block which
+ * was posted before @w and is not known to have completed yet.
+ */
+static void sim_apply(const struct sim_write *w, const struct sim_write *older)
+{
+	struct gcc_mux *gcc = sim.gcc;
+	struct sim_fault *slow;
+	unsigned int factor;
+
+	if (sim_fault_find(SIM_FAULT_IGNORE_WRITES, w->block, w->offset))
+		return;
+
+	w->block->regs[w->offset / 4] = w->val;
+
+	if (w->block->mux != &gcc->mux || w->offset != gcc->debug_ctl_reg)
+		return;
+
+	if (!(w->val & BIT(20))) {
+		sim.status = 0;
+		sim.done_at = 0;
+		return;
+	}
+
+	if (older) {
+		warnx("sim: counter started with write to %#lx+%#zx in flight",
+		      older->block->mux->phys, older->offset);
+		sim.violations++;
+	}
+
+	sim.status = BIT(25) | sim_count(w->val & 0xfffff);
+
+	slow = sim_fault_find(SIM_FAULT_SLOW, w->block, w->offset);
+	factor = slow ? slow->factor : 1;
+
+	if (sim.dry_run) {
+		sim.elapsed_ns += (uint64_t)factor * (w->val & 0xfffff) * 1000000000ULL /
+				  (sim.gcc->xo_rate ? : 4800000);
+		return;
+	}
+
+	/* The counter runs in real time, for the given number of XO ticks */
+	sim.done_at = arch_counter() + (uint64_t)factor * (w->val & 0xfffff) * arch_counter_freq() /
+		      (sim.gcc->xo_rate ? : 4800000);
+}
+
+/*
+ * Make posted writes visible, either those of @block or all of them. Writes
+ * to different blocks drained together are not ordered against each other.
+ */
+static void sim_drain(struct sim_block *block)
+{
+	const struct sim_write *older;
+	struct sim_write w;
+	unsigned int i;
+	unsigned int j;
+	unsigned int n = 0;
+
+	for (i = 0; i < sim.nposted; i++) {
+		w = sim.posted[i];
+
+		if (block && w.block != block) {
+			sim.posted[n++] = w;
+			continue;
+		}
+
+		older = NULL;
+		for (j = 0; j < i; j++) {
+			if (sim.posted[j].block != w.block) {
+				older = &sim.posted[j];
+				break;
+			}
+		}
+
+		sim_apply(&w, older);
+	}
+
+	sim.nposted = n;
+}
+
+static void *sim_map(struct debug_mux *mux)
+{
+	struct sim_block *block;
+
+	if (sim.nblocks == SIM_MAX_BLOCKS) {
+		warnx("sim: too many blocks");
+		return NULL;
+	}
+
+	block = &sim.blocks[sim.nblocks];
+	block->regs = calloc(1, mux->size);
+	if (!block->regs)
+		return NULL;
+
+	block->mux = mux;
+	sim.nblocks++;
+
+	return block->regs;
+}
+
+static uint32_t __sim_read(struct sim_block *block, size_t offset)
+{
+	struct measure_clk clk;
+	struct gcc_mux *gcc = sim.gcc;
+	unsigned long rate = 0;
+	unsigned int i;
+
+	if (sim_fault_find(SIM_FAULT_ALL_ONES, block, offset))
+		return 0xffffffff;
+
+	if (block->mux == &gcc->mux && offset == gcc->debug_status_reg) {
+		/* Completed, but never updated again */
+		if (sim_fault_find(SIM_FAULT_STUCK_STATUS, block, offset))
+			return BIT(25);
+
+		if (arch_counter() < sim.done_at ||
+		    sim_fault_find(SIM_FAULT_NO_DONE, block, offset))
+			return sim.status & ~BIT(25);
+
+		return sim.status;
+	}
+
+	if (block->mux->measure == measure_mccc) {
+		for (i = 0; i < platform_nclocks(sim.platform); i++) {
+			platform_clock(sim.platform, i, &clk);
+
+			if (clk.clk_mux == block->mux && clk.mux == offset) {
+				rate = sim_clk_rate(&clk);
+				break;
+			}
+		}
+
+		/* The memory controller is always running */
+		return 1000000000000ULL / (rate ? : sim_rates[0]);
+	}
+
+	return block->regs[offset / 4];
+}
+
+static uint32_t sim_read(void *ptr)
+{
+	struct sim_block *block;
+	size_t offset;
+	uint32_t val;
+
+	block = sim_find_block(ptr, &offset);
+	sim_drain(block);
+	sim.reads++;
+
+	val = __sim_read(block, offset);
+
+	if (sim.dry_run) {
+		printf("\tread    0x%08lx = 0x%08x\n", block->mux->phys + offset, val);
+		sim.elapsed_ns += SIM_ACCESS_NS;
+	}
+
+	return val;
+}
+
+static void sim_write(uint32_t val, void *ptr)
+{
+	struct sim_block *block;
+	size_t offset;
+
+	block = sim_find_block(ptr, &offset);
+	sim.writes++;
+
+	if (sim.dry_run) {
+		printf("\twrite   0x%08lx = 0x%08x\n", block->mux->phys + offset, val);
+		sim.elapsed_ns += SIM_ACCESS_NS;
+	}
+
+	if (sim.nposted == SIM_MAX_POSTED)
+		sim_drain(NULL);
+
+	sim.posted[sim.nposted++] = (struct sim_write) { block, offset, val };
+}
+
+static void sim_barrier(enum mmio_barrier type)
+{
+	static const char *const names[] = {
+		[MMIO_RMB] = "rmb",
+		[MMIO_WMB] = "wmb",
+		[MMIO_MB] = "mb",
+	};
+
+	sim.barriers++;
+
+	if (sim.dry_run)
+		printf("\tbarrier %s\n", names[type]);
+
+	/* Loads are never posted, only write barriers have an effect */
+	if (type != MMIO_RMB)
+		sim_drain(NULL);
+}
+
+static const struct mmio_ops sim_ops = {
+	.map = sim_map,
+	.read = sim_read,
+	.write = sim_write,
+	.barrier = sim_barrier,
+};
+
+/**
+ * sim_fault() - inject a fault into the simulation
+ * @spec: fault as "<type>[@<block>|@<address>][=<factor>]"
+ *
+ * The faults are "no-done", the counter never completes, "stuck-status", the
+ * counter status always reads as completed, "ignore-writes", the registers
+ * keep their values, "slow", the counter takes <factor> times as long to
+ * complete, and "all-ones", the registers read as all ones. Faults apply to
+ * all registers unless limited to the debug mux of a block ("gcc" for the
+ * GCC debug counter) or a single register by its physical address.
+ *
+ * The counter faults, "no-done", "stuck-status" and "slow", only exist in the
+ * GCC debug counter, which measures the clocks of every block, and can't be
+ * limited to another block. measure_ticks() waits twice the window plus
+ * GCC_TIMEOUT_US for the counter, so a "slow" factor of 2 still completes,
+ * while factors of 3 or more time out any window longer than GCC_TIMEOUT_US.
+ *
+ * Return: 0 on success, -1 if @spec is invalid
+ */
+int sim_fault(const char *spec)
+{
+	struct sim_fault *fault;
+	const char *target;
+	const char *arg;
+	unsigned int i;
+	size_t len;
+	char *end;
+
+	if (sim.nfaults == SIM_MAX_FAULTS)
+		return -1;
+
+	fault = &sim.faults[sim.nfaults];
+	fault->factor = 1;
+
+	len = strcspn(spec, "@=");
+	target = spec[len] == '@' ? spec + len + 1 : NULL;
+	arg = strchr(spec, '=');
+
+	for (i = 0; i < sizeof(sim_fault_names) / sizeof(sim_fault_names[0]); i++) {
+		if (strlen(sim_fault_names[i]) == len && !strncmp(spec, sim_fault_names[i], len))
+			break;
+	}
+	if (i == sizeof(sim_fault_names) / sizeof(sim_fault_names[0]))
+		return -1;
+	fault->type = i;
+
+	if (arg) {
+		fault->factor = strtoul(arg + 1, &end, 0);
+		if (fault->type != SIM_FAULT_SLOW || !fault->factor || *end)
+			return -1;
+	}
+
+	if (target) {
+		len = arg ? (size_t)(arg - target) : strlen(target);
+
+		if (!strncmp(target, "0x", 2)) {
+			fault->phys = strtoul(target, &end, 16);
+			if (end != target + len)
+				return -1;
+		} else {
+			fault->block = strndup(target, len);
+		}
+	}
+
+	if (fault->block && sim_fault_counter(fault->type) && strcmp(fault->block, "gcc")) {
+		warnx("sim: %s only applies to the GCC debug counter", sim_fault_names[i]);
+		free(fault->block);
+		fault->block = NULL;
+		return -1;
+	}
+
+	sim.nfaults++;
+
+	return 0;
+}
+
+/**
+ * sim_init() - route all register accesses to the simulator
+ * @platform: platform to simulate
+ * @dry_run: print the accesses and estimate their cost, rather than emulating
+ *	     the counter in real time
+ *
+ * Return: 0 on success, -1 if the platform has no GCC debug counter or a
+ * counter fault is injected into another register
+ */
+int sim_init(const struct debugcc_platform *platform, bool dry_run)
+{
+	struct sim_fault *fault;
+	unsigned int i;
+	unsigned int reg;
+
+	sim.gcc = platform_gcc(platform);
+	if (!sim.gcc) {
+		warnx("sim: no GCC debug counter found for %s", platform->name);
+		return -1;
+	}
+
+	for (i = 0; i < sim.nfaults; i++) {
+		fault = &sim.faults[i];
+		if (!fault->phys || !sim_fault_counter(fault->type))
+			continue;
+
+		reg = fault->type == SIM_FAULT_SLOW ? sim.gcc->debug_ctl_reg :
+						      sim.gcc->debug_status_reg;
+		if (fault->phys != sim.gcc->mux.phys + reg) {
+			warnx("sim: %s only applies to the GCC debug counter at %#lx",
+			      sim_fault_names[fault->type], sim.gcc->mux.phys + reg);
+			return -1;
+		}
+	}
+
+	sim.platform = platform;
+	sim.dry_run = dry_run;
+	mmio_ops = &sim_ops;
+
+	return 0;
+}
+
+/**
+ * sim_clock_begin() - start the register program of a clock
+ * @clk: clock about to be measured
+ */
+void sim_clock_begin(const struct measure_clk *clk)
+{
+	if (!sim.dry_run)
+		return;
+
+	printf("%s:\n", clk->name);
+
+	sim.clock_start = sim.elapsed_ns;
+	sim.nclocks++;
+}
+
+/**
+ * sim_clock_end() - end the register program of a clock
+ */
+void sim_clock_end(void)
+{
+	if (sim.dry_run)
+		printf("\testimated %.1fus\n", (sim.elapsed_ns - sim.clock_start) / 1000.0);
+}
+
+/**
+ * sim_elapsed_us() - time the dry run would have taken on hardware so far
+ *
+ * Return: the estimated time, 0 unless in dry-run mode
+ */
+uint64_t sim_elapsed_us(void)
+{
+	return sim.elapsed_ns / 1000;
+}
+
+/**
+ * sim_dry_run() - print the register program of a measurement or sweep
+ * @platform: platform being simulated
+ * @clk: clock to measure, or NULL to sweep the clocks of @block_name
+ * @block_name: name of the block to sweep, or NULL for all clocks
+ * @budget_us: wall clock budget of the sweep, or 0 for no limit
+ *
+ * Sweeps run through sweep(), which schedules a budget against the estimated
+ * time, so the order, precision and skipping of the clocks are those the
+ * sweep would get on hardware.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int sim_dry_run(const struct debugcc_platform *platform,
+		const struct measure_clk *clk, const char *block_name,
+		unsigned long budget_us)
+{
+	struct measurement m = {};
+
+	if (clk) {
+		measure_clock(clk, &m);
+		print_measurement(clk, &m);
+	} else if (sweep(platform, block_name, budget_us, false) < 0) {
+		return -1;
+	}
+
+	printf("estimated %.1fms for %u clocks\n", sim.elapsed_ns / 1000000.0, sim.nclocks);
+
+	return 0;
+}
+
+/**
+ * sim_report() - print access statistics of the simulation
+ *
+ * Return: number of ordering violations detected
+ */
+int sim_report(void)
+{
+	unsigned int i;
+
+	sim_drain(NULL);
+
+	fflush(stdout);
+	fprintf(stderr, "sim: %lu reads, %lu writes, %lu barriers, %lu ordering violations\n",
+		sim.reads, sim.writes, sim.barriers, sim.violations);
+
+	for (i = 0; i < sim.nfaults; i++)
+		fprintf(stderr, "sim: %s fault hit %lu times\n",
+			sim_fault_names[sim.faults[i].type], sim.faults[i].hits);
+
+	return sim.violations;
+}
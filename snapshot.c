@@ -0,0 +1,385 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Sweep snapshots and comparison
+ *
+ * The results of a sweep can be saved as a snapshot, holding one record per
+ * clock of the platform, indexed like its clock table, with the rate and
+ * resolution in Hz. Clocks left out of the sweep are marked as not measured.
+ * A hash of the clock names ties the snapshot to the clock table it was
+ * taken with, so snapshots from a different build aren't silently compared
+ * by index.
+ *
+ * Snapshots are compared clock by clock, either against the sweep in
+ * progress or against other snapshots, reporting only the clocks which were
+ * turned on or off, faulted or whose rate differs by more than the combined
+ * resolution of both measurements and the tolerance given for the clock.
+ *
+ * The file is a struct snapshot_header followed by the records, in the
+ * host's byte order.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <debugcc.h>
+
+#define SNAPSHOT_MAGIC		"DCCSNAP"
+#define SNAPSHOT_VERSION	1
+
+/* Set on records of measured clocks, alongside the MEASURE_* flags */
+#define SNAPSHOT_MEASURED	BIT(15)
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint64_t names_hash;
+	char platform[32];
+};
+
+struct snapshot_record {
+	uint64_t rate;
+	uint32_t resolution;
+	uint16_t flags;
+	int16_t error;
+};
+
+struct snapshot {
+	const char *path;
+	struct snapshot_header *header;
+	struct snapshot_record *records;
+};
+
+struct snapshot_tolerance {
+	const char *name;
+	unsigned long hz;
+	double ppm;
+};
+
+static struct snapshot live;
+
+static struct snapshot_tolerance *tolerances;
+static unsigned int ntolerances;
+
+static uint64_t snapshot_names_hash(const struct debugcc_platform *platform)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	struct measure_clk clk;
+	const char *p;
+	unsigned int i;
+
+	for (i = 0; i < platform_nclocks(platform); i++) {
+		platform_clock(platform, i, &clk);
+
+		for (p = clk.name; ; p++) {
+			hash = (hash ^ (uint8_t)*p) * 1099511628211ULL;
+			if (!*p)
+				break;
+		}
+	}
+
+	return hash;
+}
+
+/**
+ * snapshot_tolerance() - set the tolerance of snapshot comparisons
+ * @spec: "[<clk>=]<tol>", <tol> in Hz or suffixed with "%" or "ppm"
+ *
+ * Without a clock name, the tolerance applies to all clocks without one of
+ * their own.
+ *
+ * Return: 0 on success, -1 if @spec is invalid
+ */
+int snapshot_tolerance(const char *spec)
+{
+	struct snapshot_tolerance *tol;
+	const char *eq = strchr(spec, '=');
+	const char *value = eq ? eq + 1 : spec;
+	double val;
+	char *end;
+	void *tmp;
+
+	val = strtod(value, &end);
+	if (end == value || val < 0)
+		return -1;
+
+	tmp = realloc(tolerances, (ntolerances + 1) * sizeof(*tolerances));
+	if (!tmp)
+		return -1;
+	tolerances = tmp;
+
+	tol = &tolerances[ntolerances];
+	memset(tol, 0, sizeof(*tol));
+
+	if (!strcmp(end, "%"))
+		tol->ppm = val * 10000;
+	else if (!strcmp(end, "ppm"))
+		tol->ppm = val;
+	else if (!*end)
+		tol->hz = val;
+	else
+		return -1;
+
+	if (eq) {
+		tol->name = strndup(spec, eq - spec);
+		if (!tol->name)
+			return -1;
+	}
+
+	ntolerances++;
+
+	return 0;
+}
+
+static unsigned long snapshot_allowed(const char *name, unsigned long rate)
+{
+	const struct snapshot_tolerance *tol = NULL;
+	unsigned int i;
+
+	for (i = 0; i < ntolerances; i++) {
+		if (!tolerances[i].name)
+			tol = &tolerances[i];
+		else if (!strcmp(tolerances[i].name, name))
+			break;
+	}
+	if (i < ntolerances)
+		tol = &tolerances[i];
+
+	if (!tol)
+		return 0;
+
+	return tol->hz + rate * tol->ppm / 1000000;
+}
+
+/**
+ * snapshot_begin() - start recording the results of the sweep
+ * @platform: platform being swept
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int snapshot_begin(const struct debugcc_platform *platform)
+{
+	unsigned int count = platform_nclocks(platform);
+
+	live.path = "sweep";
+	live.header = calloc(1, sizeof(*live.header) + count * sizeof(*live.records));
+	if (!live.header) {
+		warn("failed to allocate snapshot");
+		return -1;
+	}
+
+	memcpy(live.header->magic, SNAPSHOT_MAGIC, sizeof(live.header->magic));
+	live.header->version = SNAPSHOT_VERSION;
+	live.header->count = count;
+	live.header->names_hash = snapshot_names_hash(platform);
+	strncpy(live.header->platform, platform->name, sizeof(live.header->platform) - 1);
+
+	live.records = (void *)(live.header + 1);
+
+	return 0;
+}
+
+/**
+ * snapshot_add() - record the measurement of a clock in the sweep's snapshot
+ * @idx: index of the clock in the platform's clock table
+ * @m: measurement of the clock
+ */
+void snapshot_add(unsigned int idx, const struct measurement *m)
+{
+	struct snapshot_record *rec;
+
+	if (!live.header || idx >= live.header->count)
+		return;
+
+	rec = &live.records[idx];
+	rec->rate = m->rate;
+	rec->resolution = m->resolution;
+	rec->flags = m->flags | SNAPSHOT_MEASURED;
+	rec->error = m->error;
+}
+
+/**
+ * snapshot_save() - write the sweep's snapshot to a file
+ * @path: file to write
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int snapshot_save(const char *path)
+{
+	size_t size = sizeof(*live.header) + live.header->count * sizeof(*live.records);
+	FILE *fp;
+	int ret;
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		warn("failed to open %s", path);
+		return -1;
+	}
+
+	ret = fwrite(live.header, size, 1, fp) == 1 ? 0 : -1;
+	if (fclose(fp) || ret < 0) {
+		warn("failed to write %s", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * snapshot_load() - map a snapshot file
+ * @path: snapshot to load
+ *
+ * Return: the snapshot, or NULL on failure
+ */
+struct snapshot *snapshot_load(const char *path)
+{
+	struct snapshot *snap;
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		warn("failed to open %s", path);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct snapshot_header)) {
+		warnx("%s: not a snapshot", path);
+		close(fd);
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		warn("failed to map %s", path);
+		return NULL;
+	}
+
+	snap = calloc(1, sizeof(*snap));
+	if (!snap) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	snap->path = path;
+	snap->header = base;
+	snap->records = base + sizeof(*snap->header);
+
+	if (memcmp(snap->header->magic, SNAPSHOT_MAGIC, sizeof(snap->header->magic)) ||
+	    snap->header->version != SNAPSHOT_VERSION ||
+	    snap->header->count > (st.st_size - sizeof(*snap->header)) / sizeof(*snap->records) ||
+	    !memchr(snap->header->platform, '\0', sizeof(snap->header->platform))) {
+		warnx("%s: not a snapshot, or truncated", path);
+		munmap(base, st.st_size);
+		free(snap);
+		return NULL;
+	}
+
+	return snap;
+}
+
+/**
+ * snapshot_platform() - name of the platform a snapshot was taken on
+ * @snap: snapshot
+ *
+ * Return: name of the platform
+ */
+const char *snapshot_platform(const struct snapshot *snap)
+{
+	return snap->header->platform;
+}
+
+static const char *snapshot_state(const struct snapshot_record *rec, char *buf, size_t size)
+{
+	if (!(rec->flags & SNAPSHOT_MEASURED) || rec->flags & MEASURE_SKIPPED)
+		return "not measured";
+	if (rec->error)
+		return "fault";
+	if (!rec->rate)
+		return "off";
+
+	snprintf(buf, size, "%luHz", (unsigned long)rec->rate);
+
+	return buf;
+}
+
+/**
+ * snapshot_diff() - compare two snapshots
+ * @platform: platform the snapshots were taken on
+ * @old: baseline snapshot
+ * @new: snapshot to compare, or NULL for the results of the sweep
+ *
+ * Prints the clocks deviating between the snapshots, preceded by the path of
+ * @new.
+ *
+ * Return: number of deviating clocks, or -1 on failure
+ */
+int snapshot_diff(const struct debugcc_platform *platform,
+		  const struct snapshot *old, const struct snapshot *new)
+{
+	const struct snapshot_record *a;
+	const struct snapshot_record *b;
+	struct measure_clk clk;
+	unsigned long allowed;
+	unsigned long delta;
+	char abuf[32];
+	char bbuf[32];
+	int deviations = 0;
+	unsigned int i;
+
+	if (!new)
+		new = &live;
+
+	if (old->header->count != new->header->count ||
+	    old->header->names_hash != new->header->names_hash ||
+	    old->header->names_hash != snapshot_names_hash(platform)) {
+		warnx("%s and %s were taken with different clock tables",
+		      old->path, new->path);
+		return -1;
+	}
+
+	for (i = 0; i < old->header->count; i++) {
+		a = &old->records[i];
+		b = &new->records[i];
+
+		/* Clocks only measured in one of the snapshots can't be compared */
+		if (!(a->flags & SNAPSHOT_MEASURED) || !(b->flags & SNAPSHOT_MEASURED) ||
+		    (a->flags | b->flags) & MEASURE_SKIPPED)
+			continue;
+
+		if (!a->error && !b->error && !a->rate == !b->rate) {
+			delta = a->rate > b->rate ? a->rate - b->rate : b->rate - a->rate;
+
+			allowed = a->resolution + b->resolution;
+			platform_clock(platform, i, &clk);
+			allowed += snapshot_allowed(clk.name, a->rate);
+
+			if (delta <= allowed)
+				continue;
+		} else if (a->error && b->error) {
+			continue;
+		}
+
+		if (!deviations++)
+			printf("%s:\n", new->path);
+
+		platform_clock(platform, i, &clk);
+		printf("%50s: %s -> %s", clk.name, snapshot_state(a, abuf, sizeof(abuf)),
+		       snapshot_state(b, bbuf, sizeof(bbuf)));
+		if (!a->error && !b->error && a->rate && b->rate)
+			printf(" (%+.3f%%)", ((double)b->rate - a->rate) * 100 / a->rate);
+		printf("\n");
+	}
+
+	return deviations;
+}
@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Timing and register access statistics
+ *
+ * The run is split into phases, entered and left around the mapping of the
+ * hardware, mux programming, counter windows and output. Time is accounted
+ * to the innermost phase, using the reference timer, and register accesses
+ * are counted per phase by wrapping the active register backend. Per clock
+ * totals are collected by measure_clock(), summed over all measurements of
+ * the clock so periodic modes don't grow them.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <debugcc.h>
+
+struct stats_count {
+	uint64_t time;
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long barriers;
+};
+
+struct stats_clock {
+	const char *name;
+	unsigned long count;
+	struct stats_count total;
+	uint64_t ticks_time;
+};
+
+static const char *const stats_phase_names[STATS_NR_PHASES] = {
+	[STATS_MAIN] = "main",
+	[STATS_PREMAP] = "premap",
+	[STATS_MMAP] = "mmap_hardware",
+	[STATS_MUX_ENABLE] = "mux_prepare_enable",
+	[STATS_MEASURE] = "measure",
+	[STATS_MEASURE_TICKS] = "measure_ticks",
+	[STATS_MUX_DISABLE] = "mux_disable",
+	[STATS_OUTPUT] = "output",
+};
+
+static struct {
+	bool enabled;
+	const struct mmio_ops *next;
+
+	enum stats_phase phase;
+	uint64_t last;
+	struct stats_count phases[STATS_NR_PHASES];
+
+	struct stats_count clock_start;
+	uint64_t clock_ticks_start;
+	struct stats_clock *clocks;
+	unsigned int nclocks;
+} stats;
+
+static void stats_account(uint64_t now)
+{
+	stats.phases[stats.phase].time += now - stats.last;
+	stats.last = now;
+}
+
+/**
+ * stats_enter() - enter a phase of the run
+ * @phase: phase being entered
+ *
+ * Return: the phase left, to be passed to stats_leave()
+ */
+enum stats_phase stats_enter(enum stats_phase phase)
+{
+	enum stats_phase prev = stats.phase;
+
+	if (!stats.enabled)
+		return prev;
+
+	stats_account(arch_counter());
+	stats.phase = phase;
+
+	return prev;
+}
+
+/**
+ * stats_leave() - leave the current phase of the run
+ * @prev: phase to return to, as returned by stats_enter()
+ */
+void stats_leave(enum stats_phase prev)
+{
+	if (!stats.enabled)
+		return;
+
+	stats_account(arch_counter());
+	stats.phase = prev;
+}
+
+static void stats_sum(struct stats_count *sum)
+{
+	unsigned int i;
+
+	memset(sum, 0, sizeof(*sum));
+
+	for (i = 0; i < STATS_NR_PHASES; i++) {
+		sum->time += stats.phases[i].time;
+		sum->reads += stats.phases[i].reads;
+		sum->writes += stats.phases[i].writes;
+		sum->barriers += stats.phases[i].barriers;
+	}
+}
+
+/* Start collecting the per clock totals of a measurement */
+void stats_clock_begin(void)
+{
+	if (!stats.enabled)
+		return;
+
+	stats_account(arch_counter());
+	stats_sum(&stats.clock_start);
+	stats.clock_ticks_start = stats.phases[STATS_MEASURE_TICKS].time;
+}
+
+void stats_clock_end(const struct measure_clk *clk)
+{
+	struct stats_clock *clock = NULL;
+	struct stats_count sum;
+	unsigned int i;
+	void *tmp;
+
+	if (!stats.enabled)
+		return;
+
+	stats_account(arch_counter());
+	stats_sum(&sum);
+
+	for (i = 0; i < stats.nclocks; i++) {
+		if (!strcmp(stats.clocks[i].name, clk->name)) {
+			clock = &stats.clocks[i];
+			break;
+		}
+	}
+
+	if (!clock) {
+		tmp = realloc(stats.clocks, (stats.nclocks + 1) * sizeof(*stats.clocks));
+		if (!tmp)
+			return;
+		stats.clocks = tmp;
+
+		clock = &stats.clocks[stats.nclocks++];
+		memset(clock, 0, sizeof(*clock));
+		clock->name = clk->name;
+	}
+
+	clock->count++;
+	clock->total.time += sum.time - stats.clock_start.time;
+	clock->total.reads += sum.reads - stats.clock_start.reads;
+	clock->total.writes += sum.writes - stats.clock_start.writes;
+	clock->total.barriers += sum.barriers - stats.clock_start.barriers;
+	clock->ticks_time += stats.phases[STATS_MEASURE_TICKS].time - stats.clock_ticks_start;
+}
+
+static void *stats_map(struct debug_mux *mux)
+{
+	return stats.next->map(mux);
+}
+
+static uint32_t stats_read(void *ptr)
+{
+	stats.phases[stats.phase].reads++;
+
+	return stats.next->read(ptr);
+}
+
+static void stats_write(uint32_t val, void *ptr)
+{
+	stats.phases[stats.phase].writes++;
+
+	stats.next->write(val, ptr);
+}
+
+static void stats_barrier(enum mmio_barrier type)
+{
+	stats.phases[stats.phase].barriers++;
+
+	stats.next->barrier(type);
+}
+
+static const struct mmio_ops stats_ops = {
+	.map = stats_map,
+	.read = stats_read,
+	.write = stats_write,
+	.barrier = stats_barrier,
+};
+
+/**
+ * stats_init() - start collecting statistics
+ * @devmem: file descriptor to an opened /dev/mem, unless simulating
+ * @start: reference timer value at the start of the run
+ *
+ * Must be called after any other register backend has been installed and
+ * before the hardware is mapped.
+ *
+ * Return: 0
+ */
+int stats_init(int devmem, uint64_t start)
+{
+	stats.enabled = true;
+	stats.last = start;
+	stats.phase = STATS_MAIN;
+
+	stats.next = mmio_next(devmem);
+	mmio_ops = &stats_ops;
+
+	return 0;
+}
+
+static double stats_us(uint64_t ticks)
+{
+	return ticks * 1000000.0 / arch_counter_freq();
+}
+
+/**
+ * stats_report() - print the per phase and per clock statistics
+ */
+void stats_report(void)
+{
+	const struct stats_count *count;
+	const struct stats_clock *clock;
+	struct stats_count total;
+	unsigned int i;
+
+	if (!stats.enabled)
+		return;
+
+	stats_account(arch_counter());
+	stats_sum(&total);
+
+	fflush(stdout);
+
+	fprintf(stderr, "%-50s %12s %6s %8s %8s %8s\n",
+		"phase", "time (us)", "share", "reads", "writes", "barriers");
+	for (i = 0; i < STATS_NR_PHASES; i++) {
+		count = &stats.phases[i];
+
+		fprintf(stderr, "%-50s %12.1f %5.1f%% %8lu %8lu %8lu\n",
+			stats_phase_names[i], stats_us(count->time),
+			total.time ? count->time * 100.0 / total.time : 0.0,
+			count->reads, count->writes, count->barriers);
+	}
+	fprintf(stderr, "%-50s %12.1f %6s %8lu %8lu %8lu\n", "total",
+		stats_us(total.time), "", total.reads, total.writes, total.barriers);
+
+	if (!stats.nclocks)
+		return;
+
+	fprintf(stderr, "\n%-50s %8s %12s %12s %8s %8s %8s\n",
+		"clock", "count", "time (us)", "ticks (us)", "reads", "writes", "barriers");
+	for (i = 0; i < stats.nclocks; i++) {
+		clock = &stats.clocks[i];
+
+		fprintf(stderr, "%-50s %8lu %12.1f %12.1f %8lu %8lu %8lu\n",
+			clock->name, clock->count, stats_us(clock->total.time),
+			stats_us(clock->ticks_time), clock->total.reads,
+			clock->total.writes, clock->total.barriers);
+	}
+}
@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Sweep over the clocks of a platform, optionally within a wall clock budget
+ *
+ * With a budget, the clocks marked as important are measured first, using the
+ * configured precision as far as the budget allows while reserving enough
+ * time to measure the remaining clocks with the "fast" preset. The remaining
+ * clocks then share what is left of the budget. Each clock gets an even share
+ * of the time remaining until the deadline, so clocks finishing early leave
+ * more time to the ones following. Clocks which can't be measured in their
+ * share are skipped. The share also caps the clocks measured with the
+ * configured precision, as slow clocks stretch their windows beyond the
+ * nominal cost.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <debugcc.h>
+
+static char **important;
+static unsigned int nimportant;
+
+static bool quiet;
+
+/**
+ * sweep_important() - mark clocks as important
+ * @names: comma separated list of clock names, checked by sweep()
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int sweep_important(const char *names)
+{
+	char *list;
+	char *name;
+	char **tmp;
+
+	list = strdup(names);
+	if (!list)
+		return -1;
+
+	for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+		tmp = realloc(important, (nimportant + 1) * sizeof(*important));
+		if (!tmp)
+			return -1;
+
+		important = tmp;
+		important[nimportant++] = name;
+	}
+
+	return 0;
+}
+
+static bool clock_important(const struct measure_clk *clk)
+{
+	unsigned int i;
+
+	for (i = 0; i < nimportant; i++) {
+		if (!strcmp(important[i], clk->name))
+			return true;
+	}
+
+	return false;
+}
+
+/* A dry run takes no time, so the time it would take on hardware is added */
+static uint64_t sweep_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000 + sim_elapsed_us();
+}
+
+/* Report the measurement of the clock at @idx of the platform's clock table */
+static void sweep_report(unsigned int idx, const struct measure_clk *clk,
+			 const struct measurement *m)
+{
+	if (!quiet)
+		print_measurement(clk, m);
+	snapshot_add(idx, m);
+}
+
+static int sweep_budget(const struct debugcc_platform *platform,
+			const struct measure_clk *clks, const unsigned int *indexes,
+			unsigned int nclks, unsigned long budget_us)
+{
+	const struct measure_config *fast = measure_preset("fast");
+	const struct measure_config *cfg;
+	struct measure_config user = measure_config;
+	struct gcc_mux *gcc = platform_gcc(platform);
+	struct measurement *results;
+	unsigned int xo_rate = gcc && gcc->xo_rate ? gcc->xo_rate : 4800000;
+	unsigned long min_cost;
+	unsigned long share;
+	unsigned int nreduced = 0;
+	unsigned int nskipped = 0;
+	unsigned int imp_left = 0;
+	unsigned int left = nclks;
+	unsigned int pass;
+	unsigned int i;
+	uint64_t remaining;
+	uint64_t deadline;
+	uint64_t reserve;
+	uint64_t now;
+	bool relaxed;
+	bool stop = false;
+
+	results = calloc(nclks, sizeof(*results));
+	if (!results)
+		return -1;
+
+	/* Clocks not reached when the sweep is stopped early count as skipped */
+	for (i = 0; i < nclks; i++)
+		results[i].flags = MEASURE_SKIPPED;
+
+	for (i = 0; i < nclks; i++) {
+		if (clock_important(&clks[i]))
+			imp_left++;
+	}
+
+	/* The shortest measurement still able to tell a running clock */
+	min_cost = 3 * fast->short_ticks * 1000000ULL / xo_rate;
+
+	/* With enough time at hand, all clocks get the configured precision */
+	relaxed = (uint64_t)nclks * measure_config_cost(&user, gcc) <= budget_us;
+
+	deadline = sweep_now_us() + budget_us;
+
+	/* Important clocks first, then the rest */
+	for (pass = 0; pass < 2 && !stop; pass++) {
+		for (i = 0; i < nclks; i++) {
+			if (clock_important(&clks[i]) != (pass == 0))
+				continue;
+
+			now = sweep_now_us();
+			remaining = deadline > now ? deadline - now : 0;
+
+			if (pass == 0) {
+				reserve = (uint64_t)(left - imp_left) * measure_config_cost(fast, gcc);
+				share = remaining > reserve ? (remaining - reserve) / imp_left : 0;
+				imp_left--;
+				cfg = &user;
+			} else {
+				share = remaining / left;
+				cfg = relaxed ? &user : fast;
+			}
+			left--;
+
+			if (share < min_cost)
+				continue;
+
+			measure_config = *cfg;
+			if (!user.budget_us || share < user.budget_us)
+				measure_config_budget(share);
+			else
+				measure_config_budget(user.budget_us);
+
+			results[i].flags = 0;
+			measure_clock(&clks[i], &results[i]);
+
+			if (cfg != &user || share < measure_config_cost(&user, gcc))
+				results[i].flags |= MEASURE_REDUCED;
+			if (results[i].flags & MEASURE_REDUCED)
+				nreduced++;
+
+			if (expect_classify(indexes[i], &results[i])) {
+				stop = true;
+				break;
+			}
+		}
+	}
+
+	measure_config = user;
+
+	for (i = 0; i < nclks; i++) {
+		if (results[i].flags & MEASURE_SKIPPED)
+			nskipped++;
+
+		sweep_report(indexes[i], &clks[i], &results[i]);
+	}
+
+	if (nreduced || nskipped)
+		fprintf(stderr, "budget of %lums: %u clocks measured at reduced precision, %u skipped\n",
+			budget_us / 1000, nreduced, nskipped);
+
+	free(results);
+
+	return 0;
+}
+
+/**
+ * sweep() - measure all clocks of a platform, or of one of its blocks
+ * @platform: debugcc_platform to measure
+ * @block_name: name of the block, or NULL for all clocks
+ * @budget_us: wall clock budget of the sweep, or 0 for no limit
+ * @no_print: don't print the results, only record them in the snapshot
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int sweep(const struct debugcc_platform *platform, const char *block_name,
+	  unsigned long budget_us, bool no_print)
+{
+	struct measure_clk *clks;
+	struct measure_clk clk;
+	struct measurement m;
+	unsigned int *indexes;
+	bool stop;
+	unsigned int nclks = 0;
+	unsigned int i;
+	int ret;
+
+	quiet = no_print;
+
+	for (i = 0; i < nimportant; i++) {
+		if (find_clock(platform, important[i], &clk) < 0) {
+			fprintf(stderr, "no clock named \"%s\"\n", important[i]);
+			return -1;
+		}
+	}
+
+	if (!budget_us) {
+		for (i = 0; i < platform_nclocks(platform); i++) {
+			platform_clock(platform, i, &clk);
+
+			if (!clock_from_block(&clk, block_name))
+				continue;
+
+			memset(&m, 0, sizeof(m));
+			measure_clock(&clk, &m);
+			stop = expect_classify(i, &m);
+			sweep_report(i, &clk, &m);
+
+			if (stop)
+				break;
+		}
+
+		return 0;
+	}
+
+	clks = calloc(platform_nclocks(platform), sizeof(*clks));
+	indexes = calloc(platform_nclocks(platform), sizeof(*indexes));
+	if (!clks || !indexes) {
+		free(clks);
+		free(indexes);
+		return -1;
+	}
+
+	for (i = 0; i < platform_nclocks(platform); i++) {
+		platform_clock(platform, i, &clks[nclks]);
+		indexes[nclks] = i;
+
+		if (clock_from_block(&clks[nclks], block_name))
+			nclks++;
+	}
+
+	ret = sweep_budget(platform, clks, indexes, nclks, budget_us);
+
+	free(indexes);
+	free(clks);
+
+	return ret;
+}
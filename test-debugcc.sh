@@ -0,0 +1,81 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Runs debugcc against the simulator, a replayed trace or the /dev/mem
+# stand-in and checks its exit status and output.
+#
+# usage: test-debugcc.sh <debugcc> <test>
+
+debugcc=$1
+out=$(mktemp)
+trap 'rm -f "$out" "$out.trace"' EXIT
+
+clk=gcc_sdcc2_apps_clk
+
+# run <status> <args>: run debugcc, bounded in time, expecting exit <status>
+run() {
+	expected=$1
+	shift
+
+	timeout 30 "$debugcc" "$@" > "$out" 2>&1
+	status=$?
+	cat "$out"
+
+	if [ $status -ne "$expected" ]; then
+		echo "exit status $status, expected $expected"
+		exit 1
+	fi
+}
+
+# expect <pattern>: the output of the last run must match <pattern>
+expect() {
+	if ! grep -q -e "$1" "$out"; then
+		echo "no output matching \"$1\""
+		exit 1
+	fi
+}
+
+case $2 in
+no-done)
+	# The counter never completes, the poll times out
+	run 0 -s -p sm8550 -F no-done $clk
+	expect "$clk: fault ("
+	expect "no-done fault hit [1-9]"
+	;;
+stuck-status)
+	# The counter never reads as idle, the poll gives up rather than hang
+	run 0 -s -p sm8550 -F stuck-status $clk
+	expect "$clk: fault ("
+	expect "stuck-status fault hit [1-9]"
+	;;
+slow)
+	# Twice as slow still completes within the poll timeout
+	run 0 -s -p sm8550 -F slow@gcc=2 $clk
+	expect "$clk: [0-9.]*MHz"
+	expect "slow fault hit [1-9]"
+	;;
+fault-scope)
+	# Counter faults only exist in the GCC debug counter
+	run 1 -s -p sm8550 -F no-done@video_cc $clk
+	expect "only applies to the GCC debug counter"
+	;;
+replay)
+	run 0 -s -p sm8550 -t "$out.trace" $clk
+	run 0 -p sm8550 -R "$out.trace" $clk
+	expect "$clk: [0-9.]*MHz"
+	expect "replay: [1-9][0-9]* records matched"
+	;;
+replay-diverge)
+	run 0 -s -p sm8550 -t "$out.trace" $clk
+	run 1 -p sm8550 -R "$out.trace" gcc_sdcc4_apps_clk
+	expect "replay: diverged at record"
+	;;
+fake-devmem)
+	run 0 -m -p sm8550 $clk
+	expect "$clk: [0-9.]*MHz"
+	;;
+*)
+	echo "unknown test \"$2\""
+	exit 1
+	;;
+esac
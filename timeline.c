@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Clock timelines in the Chrome JSON trace format
+ *
+ * Every measurement, and every sample of a directly sampled clock, is
+ * written as a counter event which the Perfetto UI and chrome://tracing
+ * display alongside other traces. The clocks of each block form a process
+ * named after the block, with one counter track per clock.
+ *
+ * Timestamps are in CLOCK_BOOTTIME, the clock Perfetto records ftrace and
+ * scheduling events in, so samples line up with a trace of the system taken
+ * at the same time.
+ *
+ * Events are streamed through a buffer written out as it fills, keeping
+ * long traces out of memory. The trace is written as a bare array of events
+ * left unterminated should debugcc be interrupted, which the viewers accept,
+ * and SIGINT and SIGTERM write out the buffer before terminating.
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <debugcc.h>
+
+#define TIMELINE_BUFSIZE	(1 << 20)
+#define TIMELINE_BLOCKS		64
+
+static struct {
+	int fd;
+	char *buf;
+	size_t len;
+
+	/* Blocks seen so far, the index + 1 is the process ID of the block */
+	const char *blocks[TIMELINE_BLOCKS];
+	unsigned int nblocks;
+
+	/* Signals kept from interrupting updates of the buffer */
+	sigset_t signals;
+	struct sigaction prev_int;
+	struct sigaction prev_term;
+} timeline = {
+	.fd = -1,
+};
+
+static void timeline_flush(void)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	while (off < timeline.len) {
+		n = write(timeline.fd, timeline.buf + off, timeline.len - off);
+		if (n <= 0)
+			break;
+		off += n;
+	}
+
+	timeline.len = 0;
+}
+
+/* Restore the previous action, run once this handler returns */
+static void timeline_signal(int sig)
+{
+	timeline_flush();
+
+	sigaction(sig, sig == SIGINT ? &timeline.prev_int : &timeline.prev_term, NULL);
+	raise(sig);
+}
+
+static void timeline_close(void)
+{
+	sigprocmask(SIG_BLOCK, &timeline.signals, NULL);
+
+	/* Flushed first, so the terminator always fits */
+	timeline_flush();
+	memcpy(timeline.buf, "\n]\n", 3);
+	timeline.len = 3;
+	timeline_flush();
+
+	close(timeline.fd);
+	timeline.fd = -1;
+}
+
+static void timeline_emit(const char *fmt, ...)
+{
+	sigset_t old;
+	va_list ap;
+	int n;
+
+	sigprocmask(SIG_BLOCK, &timeline.signals, &old);
+
+	va_start(ap, fmt);
+	n = vsnprintf(timeline.buf + timeline.len, TIMELINE_BUFSIZE - timeline.len, fmt, ap);
+	va_end(ap);
+
+	if (n >= 0 && timeline.len + n >= TIMELINE_BUFSIZE) {
+		timeline_flush();
+
+		va_start(ap, fmt);
+		n = vsnprintf(timeline.buf, TIMELINE_BUFSIZE, fmt, ap);
+		va_end(ap);
+	}
+
+	if (n >= 0 && (size_t)n < TIMELINE_BUFSIZE - timeline.len)
+		timeline.len += n;
+
+	sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+ * timeline_open() - write a timeline of the measurements
+ * @path: trace file to write
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int timeline_open(const char *path)
+{
+	struct sigaction sa = { .sa_handler = timeline_signal };
+
+	timeline.buf = malloc(TIMELINE_BUFSIZE);
+	if (!timeline.buf) {
+		warn("failed to allocate timeline buffer");
+		return -1;
+	}
+
+	timeline.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (timeline.fd < 0) {
+		warn("failed to open %s", path);
+		return -1;
+	}
+
+	sigemptyset(&timeline.signals);
+	sigaddset(&timeline.signals, SIGINT);
+	sigaddset(&timeline.signals, SIGTERM);
+
+	sa.sa_mask = timeline.signals;
+	sigaction(SIGINT, &sa, &timeline.prev_int);
+	sigaction(SIGTERM, &sa, &timeline.prev_term);
+	atexit(timeline_close);
+
+	timeline_emit("[");
+
+	return 0;
+}
+
+static unsigned int timeline_block(const struct measure_clk *clk)
+{
+	const char *name = clk->clk_mux->block_name ? : "gcc";
+	unsigned int i;
+
+	for (i = 0; i < timeline.nblocks; i++) {
+		if (!strcmp(timeline.blocks[i], name))
+			return i + 1;
+	}
+
+	/* Blocks beyond the limit share the last process */
+	if (i == TIMELINE_BLOCKS)
+		return i;
+
+	timeline.blocks[timeline.nblocks++] = name;
+
+	timeline_emit("%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":0,"
+		      "\"args\":{\"name\":\"%s\"}}", i ? "," : "", i + 1, name);
+
+	return i + 1;
+}
+
+/**
+ * timeline_sample() - add a sample of a clock to the timeline
+ * @clk: clock sampled
+ * @m: measurement of the clock, faults aren't added
+ * @timestamp: time of the sample, in arch_counter() ticks
+ */
+void timeline_sample(const struct measure_clk *clk, const struct measurement *m,
+		     uint64_t timestamp)
+{
+	uint64_t freq = arch_counter_freq();
+	uint64_t counter = arch_counter();
+	unsigned int pid;
+	struct timespec ts;
+	uint64_t delta;
+	uint64_t ns;
+
+	if (timeline.fd < 0 || m->error)
+		return;
+
+	/* Both clocks are read now, so suspend between samples is accounted */
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	delta = counter - timestamp;
+	ns -= delta / freq * 1000000000ULL + delta % freq * 1000000000ULL / freq;
+
+	pid = timeline_block(clk);
+
+	timeline_emit(",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":%u,\"tid\":0,"
+		      "\"ts\":%" PRIu64 ".%03u,\"args\":{\"Hz\":%lu}}",
+		      clk->name, pid, ns / 1000, (unsigned int)(ns % 1000), m->rate);
+}
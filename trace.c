@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * MMIO access tracing
+ *
+ * Every register access, and every barrier, is recorded with its physical
+ * address, value and a timestamp of the reference timer into a preallocated
+ * ring buffer, by wrapping the active register backend. Recording is a
+ * handful of stores, so tracing can be left enabled during long runs; once
+ * the ring is full the oldest records are overwritten. Only a single thread
+ * may access registers while tracing.
+ *
+ * The ring is written to the trace file at exit, or when debugcc is killed
+ * or faults, using only async-signal-safe calls. The file starts with a
+ * struct trace_header followed by the records, oldest first, in the host's
+ * byte order.
+ */
+
+#include <sys/mman.h>
+#include <err.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <debugcc.h>
+
+#define TRACE_RECORDS	(1 << 16)
+#define TRACE_MAX_BLOCKS	32
+
+struct trace_block {
+	void *base;
+	size_t size;
+	unsigned long phys;
+};
+
+static struct {
+	const struct mmio_ops *next;
+	const char *path;
+
+	struct trace_block blocks[TRACE_MAX_BLOCKS];
+	unsigned int nblocks;
+	const struct trace_block *last;
+
+	struct trace_header header;
+	struct trace_record *records;
+	uint64_t head;
+} trace;
+
+static const int trace_signals[] = { SIGINT, SIGTERM, SIGHUP, SIGBUS, SIGSEGV };
+
+#define TRACE_NSIGNALS	(sizeof(trace_signals) / sizeof(trace_signals[0]))
+
+/* Actions in place before tracing, such as other sinks flushing their output */
+static struct sigaction trace_prev[TRACE_NSIGNALS];
+
+static unsigned long trace_phys(void *ptr)
+{
+	const struct trace_block *block = trace.last;
+	unsigned int i;
+
+	if (block && ptr >= block->base && ptr < block->base + block->size)
+		return block->phys + (ptr - block->base);
+
+	for (i = 0; i < trace.nblocks; i++) {
+		block = &trace.blocks[i];
+
+		if (ptr >= block->base && ptr < block->base + block->size) {
+			trace.last = block;
+			return block->phys + (ptr - block->base);
+		}
+	}
+
+	return 0;
+}
+
+static inline void trace_record(unsigned int type, unsigned long phys, uint32_t val)
+{
+	uint64_t idx = __atomic_load_n(&trace.head, __ATOMIC_RELAXED);
+	struct trace_record *rec = &trace.records[(idx - 1) & (TRACE_RECORDS - 1)];
+
+	if (idx && type == TRACE_READ && rec->type == type && rec->phys == phys &&
+	    rec->val == val) {
+		rec->repeat++;
+		return;
+	}
+
+	rec = &trace.records[idx & (TRACE_RECORDS - 1)];
+	rec->timestamp = arch_counter();
+	rec->phys = phys;
+	rec->val = val;
+	rec->type = type;
+	rec->repeat = 0;
+
+	__atomic_store_n(&trace.head, idx + 1, __ATOMIC_RELEASE);
+}
+
+static void *trace_map(struct debug_mux *mux)
+{
+	struct trace_block *block;
+	void *base;
+
+	if (trace.nblocks == TRACE_MAX_BLOCKS) {
+		warnx("trace: too many blocks");
+		return NULL;
+	}
+
+	base = trace.next->map(mux);
+	if (!base || base == MAP_FAILED)
+		return base;
+
+	block = &trace.blocks[trace.nblocks++];
+	block->base = base;
+	block->size = mux->size;
+	block->phys = mux->phys;
+
+	return base;
+}
+
+static uint32_t trace_read(void *ptr)
+{
+	uint32_t val = trace.next->read(ptr);
+
+	trace_record(TRACE_READ, trace_phys(ptr), val);
+
+	return val;
+}
+
+static void trace_write(uint32_t val, void *ptr)
+{
+	trace_record(TRACE_WRITE, trace_phys(ptr), val);
+
+	trace.next->write(val, ptr);
+}
+
+static void trace_barrier(enum mmio_barrier type)
+{
+	trace_record(TRACE_BARRIER, 0, type);
+
+	trace.next->barrier(type);
+}
+
+static const struct mmio_ops trace_ops = {
+	.map = trace_map,
+	.read = trace_read,
+	.write = trace_write,
+	.barrier = trace_barrier,
+};
+
+static int trace_write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n <= 0)
+			return -1;
+
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Async-signal-safe, as it is called from trace_signal() */
+static int trace_dump(void)
+{
+	uint64_t head = __atomic_load_n(&trace.head, __ATOMIC_RELAXED);
+	uint64_t count = head < TRACE_RECORDS ? head : TRACE_RECORDS;
+	unsigned int start = (head - count) & (TRACE_RECORDS - 1);
+	unsigned int first = TRACE_RECORDS - start < count ? TRACE_RECORDS - start : count;
+	int ret;
+	int fd;
+
+	if (!trace.records)
+		return 0;
+
+	fd = open(trace.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+
+	trace.header.count = count;
+	trace.header.dropped = head - count;
+
+	ret = trace_write_all(fd, &trace.header, sizeof(trace.header));
+	if (!ret)
+		ret = trace_write_all(fd, &trace.records[start], first * sizeof(*trace.records));
+	if (!ret)
+		ret = trace_write_all(fd, trace.records, (count - first) * sizeof(*trace.records));
+
+	close(fd);
+
+	return ret;
+}
+
+static void trace_exit(void)
+{
+	if (trace_dump() < 0)
+		warn("failed to write trace to %s", trace.path);
+	else if (trace.header.dropped)
+		warnx("trace: %lu oldest records dropped", (unsigned long)trace.header.dropped);
+
+	trace.records = NULL;
+}
+
+/*
+ * Once the trace is written, the previous action is restored and the signal
+ * raised again, delivered as soon as this handler returns.
+ */
+static void trace_signal(int sig)
+{
+	unsigned int i;
+
+	trace_dump();
+	trace.records = NULL;
+
+	for (i = 0; i < TRACE_NSIGNALS; i++) {
+		if (trace_signals[i] == sig)
+			sigaction(sig, &trace_prev[i], NULL);
+	}
+
+	raise(sig);
+}
+
+/**
+ * trace_init() - record all register accesses
+ * @path: file to write the trace to
+ * @platform: platform being measured
+ * @devmem: file descriptor to an opened /dev/mem, unless simulating
+ *
+ * Must be called after any other register backend has been installed and
+ * before the hardware is mapped.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int trace_init(const char *path, const struct debugcc_platform *platform, int devmem)
+{
+	struct sigaction sa = { .sa_handler = trace_signal };
+	struct gcc_mux *gcc = platform_gcc(platform);
+	unsigned int i;
+
+	trace.records = calloc(TRACE_RECORDS, sizeof(*trace.records));
+	if (!trace.records) {
+		warn("failed to allocate trace buffer");
+		return -1;
+	}
+
+	memcpy(trace.header.magic, TRACE_MAGIC, sizeof(trace.header.magic));
+	trace.header.version = TRACE_VERSION;
+	trace.header.counter_freq = arch_counter_freq();
+	strncpy(trace.header.platform, platform->name, sizeof(trace.header.platform) - 1);
+
+	if (gcc && gcc->calibrated) {
+		trace.header.xo_rate = gcc->xo_rate;
+		trace.header.count_offset = gcc->count_offset;
+		trace.header.tick_offset = gcc->tick_offset;
+	}
+
+	trace.path = path;
+	trace.next = mmio_next(devmem);
+	mmio_ops = &trace_ops;
+
+	atexit(trace_exit);
+	sigemptyset(&sa.sa_mask);
+	for (i = 0; i < TRACE_NSIGNALS; i++)
+		sigaction(trace_signals[i], &sa, &trace_prev[i]);
+
+	return 0;
+}
@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Triggering on clock rate changes
+ *
+ * A set of clocks is sampled round-robin with the "sample" preset, a single
+ * counter window per sample, into a ring buffer holding the most recent
+ * samples. Each clock is measured once beforehand, so that slow clocks get a
+ * window long enough for them to count, see measure_sample_ticks(). Once a
+ * sample meets the trigger condition, sampling continues for the requested
+ * number of samples and the window around the trigger is printed, with times
+ * relative to the trigger. Sampling gives up after the optional timeout.
+ *
+ * Rates are compared against the previous sample of the same clock. Changes
+ * within twice the resolution of the samples are considered noise of the
+ * counter. Clocks sampled too coarsely to tell a rate threshold from off are
+ * refused.
+ */
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <debugcc.h>
+
+enum trigger_cond {
+	TRIGGER_CHANGE,
+	TRIGGER_ABOVE,
+	TRIGGER_BELOW,
+	TRIGGER_ON,
+	TRIGGER_OFF,
+};
+
+struct trigger_sample {
+	uint64_t timestamp;
+	unsigned int clk;
+	struct measurement m;
+};
+
+static struct {
+	enum trigger_cond cond;
+	unsigned long threshold;
+	unsigned int pre;
+	unsigned int post;
+} trigger = {
+	.pre = 16,
+	.post = 16,
+};
+
+/**
+ * trigger_parse() - parse a trigger condition
+ * @spec: "<cond>[:<pre>[:<post>]]"
+ *
+ * The condition is one of "change", "on", "off", ">rate" or "<rate", the
+ * latter triggering when a clock crosses the given rate. @pre and @post are
+ * the number of samples to print before and after the trigger.
+ *
+ * Return: 0 on success, -1 if @spec is invalid
+ */
+int trigger_parse(const char *spec)
+{
+	size_t len = strcspn(spec, ":");
+	const char *arg = spec + len;
+	char *end;
+
+	if (len == 6 && !strncmp(spec, "change", len)) {
+		trigger.cond = TRIGGER_CHANGE;
+	} else if (len == 2 && !strncmp(spec, "on", len)) {
+		trigger.cond = TRIGGER_ON;
+	} else if (len == 3 && !strncmp(spec, "off", len)) {
+		trigger.cond = TRIGGER_OFF;
+	} else if (spec[0] == '>' || spec[0] == '<') {
+		trigger.cond = spec[0] == '>' ? TRIGGER_ABOVE : TRIGGER_BELOW;
+		trigger.threshold = strtoul(spec + 1, &end, 0);
+		if (end != arg || end == spec + 1)
+			return -1;
+	} else {
+		return -1;
+	}
+
+	if (*arg == ':') {
+		trigger.pre = strtoul(arg + 1, &end, 0);
+		arg = end;
+	}
+
+	if (*arg == ':') {
+		trigger.post = strtoul(arg + 1, &end, 0);
+		arg = end;
+	}
+
+	return *arg ? -1 : 0;
+}
+
+static bool trigger_hit(const struct measurement *prev, const struct measurement *m)
+{
+	unsigned long noise = 2 * (prev->resolution > m->resolution ?
+				   prev->resolution : m->resolution);
+
+	switch (trigger.cond) {
+	case TRIGGER_CHANGE:
+		if (!prev->rate != !m->rate)
+			return true;
+		return m->rate > prev->rate + noise || prev->rate > m->rate + noise;
+	case TRIGGER_ABOVE:
+		return prev->rate <= trigger.threshold && m->rate > trigger.threshold;
+	case TRIGGER_BELOW:
+		return prev->rate >= trigger.threshold && m->rate < trigger.threshold;
+	case TRIGGER_ON:
+		return !prev->rate && m->rate;
+	case TRIGGER_OFF:
+		return prev->rate && !m->rate;
+	}
+
+	return false;
+}
+
+static void trigger_print(const struct measure_clk *clk, const struct trigger_sample *s,
+			  uint64_t at, bool hit)
+{
+	double us = ((double)s->timestamp - at) * 1000000.0 / arch_counter_freq();
+	const char *mark = hit ? " <- trigger" : "";
+
+	if (s->m.error)
+		printf("%+12.1f %50s: fault (%s)%s\n", us, clk->name, strerror(-s->m.error), mark);
+	else if (!s->m.rate)
+		printf("%+12.1f %50s: off%s\n", us, clk->name, mark);
+	else
+		printf("%+12.1f %50s: %luHz%s\n", us, clk->name, s->m.rate, mark);
+}
+
+/**
+ * trigger_run() - sample clocks until the trigger condition is met
+ * @clks: clocks to sample
+ * @nclks: number of clocks in @clks
+ * @timeout_us: time to wait for the trigger, or 0 to wait forever
+ *
+ * Return: 0 once the window around the trigger has been printed, -1 on failure
+ * or timeout
+ */
+int trigger_run(const struct measure_clk *clks, unsigned int nclks,
+		unsigned long timeout_us)
+{
+	uint64_t deadline = UINT64_MAX;
+	unsigned int size = trigger.pre + trigger.post + 1;
+	struct trigger_sample *ring;
+	struct measurement *last;
+	struct trigger_sample *s;
+	unsigned long resolution;
+	unsigned int *ticks;
+	uint64_t hit = UINT64_MAX;
+	uint64_t count;
+	uint64_t first;
+	uint64_t i;
+	unsigned int clk;
+
+	ring = calloc(size, sizeof(*ring));
+	last = calloc(nclks, sizeof(*last));
+	ticks = calloc(nclks, sizeof(*ticks));
+	if (!ring || !last || !ticks) {
+		warn("failed to allocate sample buffer");
+		goto err;
+	}
+
+	for (clk = 0; clk < nclks; clk++) {
+		measure_clock(&clks[clk], &last[clk]);
+		ticks[clk] = measure_sample_ticks(&clks[clk], last[clk].rate, &resolution);
+
+		if ((trigger.cond == TRIGGER_ABOVE || trigger.cond == TRIGGER_BELOW) &&
+		    resolution > trigger.threshold) {
+			warnx("trigger: %s is sampled with a resolution of %luHz, too coarse for %luHz",
+			      clks[clk].name, resolution, trigger.threshold);
+			goto err;
+		}
+	}
+
+	measure_config_preset("sample");
+
+	if (timeout_us)
+		deadline = arch_counter() + timeout_us * arch_counter_freq() / 1000000;
+
+	for (count = 0; hit == UINT64_MAX || count <= hit + trigger.post; count++) {
+		clk = count % nclks;
+
+		s = &ring[count % size];
+		s->clk = clk;
+		memset(&s->m, 0, sizeof(s->m));
+		measure_config.short_ticks = ticks[clk];
+		measure_clock(&clks[clk], &s->m);
+		s->timestamp = arch_counter();
+
+		/* The first round only establishes the initial rates */
+		if (hit == UINT64_MAX && count >= nclks && !s->m.error &&
+		    !last[clk].error && trigger_hit(&last[clk], &s->m))
+			hit = count;
+
+		last[clk] = s->m;
+
+		if (hit == UINT64_MAX && s->timestamp >= deadline) {
+			warnx("trigger: no trigger within %lums", timeout_us / 1000);
+			goto err;
+		}
+	}
+
+	first = hit > trigger.pre ? hit - trigger.pre : 0;
+	for (i = first; i < count; i++) {
+		s = &ring[i % size];
+		trigger_print(&clks[s->clk], s, ring[hit % size].timestamp, i == hit);
+	}
+
+	free(ticks);
+	free(last);
+	free(ring);
+
+	return 0;
+
+err:
+	free(ticks);
+	free(last);
+	free(ring);
+
+	return -1;
+}